@@ -57,6 +57,7 @@
 
 #include "fuser.h"
 #include "signals.h"
+#include "pwcache.h"
 #include "i18n.h"
 
 //#define DEBUG 1
@@ -125,7 +126,7 @@ static void usage(const char *errormsg)
 
 	fprintf(stderr,
 		_
-		("Usage: fuser [-fMuv] [-a|-s] [-4|-6] [-c|-m|-n SPACE] [-k [-i] [-SIGNAL]] NAME...\n"
+		("Usage: fuser [-fMNuv] [-a|-s] [-4|-6] [-c|-m|-n SPACE] [-k [-i] [-SIGNAL]] NAME...\n"
 		 "       fuser -l\n" "       fuser -V\n"
 		 "Show which processes use the named files, sockets, or filesystems.\n\n"
 		 "  -a,--all              display unused files too\n"
@@ -135,6 +136,7 @@ static void usage(const char *errormsg)
 		 "  -m,--mount            show all processes using the named filesystems or block device\n"
 		 "  -M,--ismountpoint     fulfill request only if NAME is a mount point\n"
 		 "  -n,--namespace SPACE  search in this name space (file, udp, or tcp)\n"
+		 "  -N,--numeric-uids     show user IDs as numbers, don't look up names\n"
 		 "  -s,--silent           silent operation\n"
 		 "  -SIGNAL               send this signal instead of SIGKILL\n"
 		 "  -u,--user             display user IDs\n"
@@ -901,6 +903,7 @@ int main(int argc, char *argv[])
 		{"mount", 0, NULL, 'm'},
 		{"ismountpoint", 0, NULL, 'M'},
 		{"namespace", 1, NULL, 'n'},
+		{"numeric-uids", 0, NULL, 'N'},
 		{"silent", 0, NULL, 's'},
 		{"user", 0, NULL, 'u'},
 		{"verbose", 0, NULL, 'v'},
@@ -1009,6 +1012,9 @@ int main(int argc, char *argv[])
 			else
 				usage(_("Invalid namespace name"));
 			break;
+		  case 'N':
+			opts |= OPT_NUMERIC_UIDS;
+			break;
 		  case 's':
 			opts |= OPT_SILENT;
 			break;
@@ -1163,7 +1169,7 @@ print_matches(struct names *names_head, const opt_type opts,
 	char head = 0;
 	char first = 1;
 	int len = 0;
-	struct passwd *pwent = NULL;
+	const char *username = NULL;
 	int have_match = 0;
 	int have_kill = 0;
 	int name_has_procs = 0;
@@ -1216,11 +1222,9 @@ print_matches(struct names *names_head, const opt_type opts,
 					continue;
 
 				have_match = 1;
-				if (opts & (OPT_VERBOSE | OPT_USER)) {
-					if (pwent == NULL
-					    || pwent->pw_uid != pptr->uid)
-						pwent = getpwuid(pptr->uid);
-				}
+				if ((opts & (OPT_VERBOSE | OPT_USER))
+				    && !(opts & OPT_NUMERIC_UIDS))
+					username = get_username(pptr->uid);
 				if (len > NAME_FIELD && (opts & OPT_VERBOSE)) {
 					putc('\n', stderr);
 					len = 0;
@@ -1229,12 +1233,15 @@ print_matches(struct names *names_head, const opt_type opts,
 					while (len++ < NAME_FIELD)
 						putc(' ', stderr);
 				if (opts & OPT_VERBOSE) {
-					if (pwent == NULL)
+					if (opts & OPT_NUMERIC_UIDS)
+						fprintf(stderr, " %-8u ",
+							(unsigned)pptr->uid);
+					else if (username == NULL)
 						fprintf(stderr, " %-8s ",
 							_("(unknown)"));
 					else
 						fprintf(stderr, " %-8s ",
-							pwent->pw_name);
+							username);
 				}
 				if (pptr->proc_type == PTYPE_NORMAL)
 					printf(" %5d", pptr->pid);
@@ -1284,12 +1291,15 @@ print_matches(struct names *names_head, const opt_type opts,
 						putc('m', stderr);
 				}
 				if (opts & OPT_USER) {
-					if (pwent == NULL)
+					if (opts & OPT_NUMERIC_UIDS)
+						fprintf(stderr, "(%u)",
+							(unsigned)pptr->uid);
+					else if (username == NULL)
 						fprintf(stderr, " %-8s ",
 							_("(unknown)"));
 					else
 						fprintf(stderr, "(%s)",
-							pwent->pw_name);
+							username);
 				}
 				if (opts & OPT_VERBOSE) {
 					if (pptr->command == NULL)
@@ -11,6 +11,7 @@ typedef unsigned short opt_type;
 #define OPT_USER 64
 #define OPT_ISMOUNTPOINT 128
 #define OPT_WRITE 256
+#define OPT_NUMERIC_UIDS 512
 
 struct procs {
 	pid_t pid;
@@ -38,6 +38,11 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <mntent.h>
 #include <getopt.h>
 #include <pwd.h>
 #include <regex.h>
@@ -55,9 +60,14 @@
 #include "i18n.h"
 #include "comm.h"
 #include "signals.h"
+#include "snapshot.h"
 
 #define PROC_BASE "/proc"
-#define MAX_NAMES (int)(sizeof(unsigned long)*8)
+
+/* Bitmap of the names that matched a process, one bit per name */
+#define FOUND_BITS (8 * sizeof (unsigned long))
+#define FOUND_WORDS(names) (((names) + FOUND_BITS - 1) / FOUND_BITS)
+#define IS_FOUND(found, i) ((found)[(i) / FOUND_BITS] >> ((i) % FOUND_BITS) & 1)
 
 #define TSECOND "s"
 #define TMINUTE "m"
@@ -82,10 +92,32 @@
 
 #define NOT_PIDOF_OPTION if (pidof) usage(NULL)
 
+/* Long options without a short form */
+#define OPT_SNAPSHOT      256
+#define OPT_SAVE_SNAPSHOT 257
+#define OPT_WAIT_TIMEOUT  258
+#define OPT_ESCALATE      259
+#define OPT_CGROUP        260
+
 static int verbose = 0, exact = 0, interactive = 0, reg = 0,
            quiet = 0, wait_until_dead = 0, process_group = 0,
            ignore_case = 0, pidof;
-static long younger_than = 0, older_than = 0;
+static long younger_than = 0, older_than = 0, wait_timeout = 0;
+static struct snapshot *snapshot = NULL;	/* pidof --snapshot */
+static const char *cgroup = NULL;		/* --cgroup */
+
+/* A step of the --escalate policy: send signal, then wait timeout seconds
+   (0 for as long as -w would) for the processes to die. Without
+   --escalate there is just the one signal. */
+struct stage
+{
+  int signal;
+  long timeout;
+  const char *name;		/* as given, for the report */
+};
+
+static struct stage *stages = NULL, single_stage;
+static int nstages = 0;
 
 static int
 ask (char *name, pid_t pid, const int signal)
@@ -141,12 +173,20 @@ uptime()
    return atof(buf);
 }
 
-/* process age from jiffies to seconds via uptime */
+/* process age from jiffies to seconds via uptime, both read once per run */
 static double process_age(const unsigned long long jf)
 {
-   double sc_clk_tck = sysconf(_SC_CLK_TCK);
-   assert(sc_clk_tck > 0);
-   return uptime() - jf / sc_clk_tck;
+   static double now = -1, sc_clk_tck;
+   double age;
+
+   if (now < 0) {
+      sc_clk_tck = sysconf(_SC_CLK_TCK);
+      assert(sc_clk_tck > 0);
+      now = uptime();
+   }
+   age = now - jf / sc_clk_tck;
+   /* started after uptime was read: one tick is as young as it gets */
+   return age > 0 ? age : 1 / sc_clk_tck;
 }
 
 /* returns requested time interval in seconds, 
@@ -183,33 +223,795 @@ parse_time_units(const char* age)
    return -1;
 }
 
+/* Tells whether pid, whose directory is below the /proc descriptor
+   proc_fd, runs as uid. That is who owns the directory, so there is
+   nothing to parse. A process that is gone doesn't match. */
 static int
-match_process_uid(pid_t pid, uid_t uid)
+match_process_uid (int proc_fd, pid_t pid, uid_t uid)
 {
-	char buf[128];
-	uid_t puid;
-	FILE *f;
-	int re = -1;
-	
-	snprintf (buf, sizeof buf, PROC_BASE "/%d/status", pid);
-	if (!(f = fopen (buf, "r")))
-		return 0;
-	
-	while (fgets(buf, sizeof buf, f))
+  struct stat st;
+  char name[sizeof (int) * 3 + 2];
+
+  snprintf (name, sizeof name, "%d", pid);
+  return fstatat (proc_fd, name, &st, 0) == 0 && st.st_uid == uid;
+}
+
+/* Makes *buf, of *size bytes, hold at least need bytes. */
+static void
+grow_buffer (char **buf, size_t *size, size_t need)
+{
+  if (need <= *size)
+    return;
+  if (!*size)
+    *size = 1024;
+  while (*size < need)
+    *size *= 2;
+  if (!(*buf = realloc (*buf, *size)))
+    {
+      perror ("realloc");
+      exit (1);
+    }
+}
+
+/* Reads /proc/PID/cmdline, or its copy in the snapshot, into *buf of *size
+   bytes, which is grown as needed and reused for every process. A NUL
+   follows the contents. Returns their length, or -1 if the process is
+   gone. */
+static ssize_t
+read_proc_cmdline (pid_t pid, char **buf, size_t *size)
+{
+  const struct snapshot_record *rec;
+  char path[32];
+  ssize_t len = 0, got;
+  int fd;
+
+  if (snapshot)
+    {
+      if (!(rec = snapshot_find (snapshot, pid)))
+	return -1;
+      grow_buffer (buf, size, rec->cmdline_len + 1);
+      len = rec->cmdline_len;
+      memcpy (*buf, snapshot_string (snapshot, rec->cmdline), len);
+      (*buf)[len] = 0;
+      return len;
+    }
+  snprintf (path, sizeof path, PROC_BASE "/%d/cmdline", pid);
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return -1;
+  /* the kernel hands out all it has at once, so a short read is the end */
+  do
+    {
+      grow_buffer (buf, size, len + 2);
+      if ((got = read (fd, *buf + len, *size - len - 1)) < 0)
 	{
-		if (sscanf (buf, "Uid:\t%d", &puid))
-		{
-			re = uid==puid;
-			break;
-		}
+	  if (errno == EINTR)
+	    continue;
+	  (void) close (fd);
+	  return -1;
 	}
-	fclose(f);
-	if (re==-1)
+      len += got;
+    }
+  while (got && len == *size - 1);
+  (void) close (fd);
+  (*buf)[len] = 0;
+  return len;
+}
+
+/* The fields of /proc/PID/stat that kill_all looks at */
+struct proc_stat
+{
+  char comm[COMM_LEN];
+  pid_t pgrp;
+  unsigned long long starttime;	/* in clock ticks after boot */
+};
+
+/* Reads /proc/PID/stat, or its copy in the snapshot, with a single read
+   and picks the fields of ps out of it. Returns 0 if the process is gone
+   or its stat is cut short. */
+static int
+read_proc_stat (pid_t pid, struct proc_stat *ps)
+{
+  const struct snapshot_record *rec;
+  char buf[1024], path[32], *comm, *end, *field;
+  ssize_t len;
+  int fd, i;
+
+  if (snapshot)
+    {
+      if (!(rec = snapshot_find (snapshot, pid)))
+	return 0;
+      snprintf (buf, sizeof buf, "%s", snapshot_string (snapshot, rec->stat));
+    }
+  else
+    {
+      snprintf (path, sizeof path, PROC_BASE "/%d/stat", pid);
+      if ((fd = open (path, O_RDONLY)) < 0)
+	return 0;
+      len = read (fd, buf, sizeof buf - 1);
+      (void) close (fd);
+      if (len <= 0)
+	return 0;
+      buf[len] = 0;
+    }
+  /* commands may have spaces or ) in them, so only the last ) ends it */
+  if (!(comm = strchr (buf, '(')) || !(end = strrchr (++comm, ')')))
+    return 0;
+  if ((len = end - comm) > COMM_LEN - 1)
+    len = COMM_LEN - 1;
+  memcpy (ps->comm, comm, len);
+  ps->comm[len] = 0;
+  /* the fields after it, numbered from 3 (state) up to 22 (starttime) */
+  for (field = end + 1, i = 3; i <= 22; i++)
+    {
+      while (*field == ' ')
+	field++;
+      if (!*field)
+	return 0;
+      if (i == 5)
+	ps->pgrp = (pid_t) strtol (field, NULL, 10);
+      else if (i == 22)
+	ps->starttime = strtoull (field, NULL, 10);
+      while (*field && *field != ' ')
+	field++;
+    }
+  return 1;
+}
+
+/* Open addressing set of the process groups -g has come across */
+struct pgid_set
+{
+  pid_t *slots;			/* -1 if empty */
+  unsigned int mask;
+  unsigned int count;
+};
+
+#define PGID_HASH(pgid, mask) (((unsigned int) (pgid) * 2654435761U) & (mask))
+
+/* Adds pgid to set. Returns 1 if it was there already. */
+static int
+add_pgid (struct pgid_set *set, pid_t pgid)
+{
+  pid_t *old = set->slots;
+  unsigned int slot, i, old_size = old ? set->mask + 1 : 0;
+
+  if (2 * (set->count + 1) > old_size)
+    {
+      set->mask = old_size ? 2 * old_size - 1 : 255;
+      if (!(set->slots = malloc ((set->mask + 1) * sizeof (pid_t))))
 	{
-		fprintf(stderr, _("Cannot get UID from process status\n"));
-		exit(1);
+	  perror ("malloc");
+	  exit (1);
 	}
-	return re;
+      memset (set->slots, -1, (set->mask + 1) * sizeof (pid_t));
+      set->count = 0;
+      for (i = 0; i < old_size; i++)
+	if (old[i] >= 0)
+	  (void) add_pgid (set, old[i]);
+      free (old);
+    }
+  for (slot = PGID_HASH (pgid, set->mask); set->slots[slot] >= 0;
+       slot = (slot + 1) & set->mask)
+    if (set->slots[slot] == pgid)
+      return 1;
+  set->slots[slot] = pgid;
+  set->count++;
+  return 0;
+}
+
+/* A process, or with -g a process group, that has been signalled */
+struct target
+{
+  pid_t id;
+  int pidfd;			/* -1 if there is none */
+  char *name;
+};
+
+/* Returns a pidfd for pid, or -1 if the kernel or libc can't give one. */
+static int
+open_pidfd (pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall (SYS_pidfd_open, pid, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+/* Sends signal to id, through pidfd if there is one. */
+static int
+send_signal (int pidfd, pid_t id, int signal)
+{
+#ifdef SYS_pidfd_send_signal
+  if (pidfd >= 0)
+    return syscall (SYS_pidfd_send_signal, pidfd, signal, NULL, 0);
+#endif
+  return kill (process_group ? -id : id, signal);
+}
+
+static void
+drop_target (struct target *targets, int i, int *count)
+{
+  if (targets[i].pidfd >= 0)
+    (void) close (targets[i].pidfd);
+  free (targets[i].name);
+  targets[i] = targets[--*count];
+}
+
+/* Milliseconds on a clock that is never set back */
+static long long
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* When stage is over, in now_ms time, or 0 if it lasts until all are dead */
+static long long
+stage_deadline (int stage)
+{
+  long secs = stages[stage].timeout;
+
+  if (!secs && stage == nstages - 1)
+    secs = wait_timeout;
+  return secs ? now_ms () + secs * 1000LL : 0;
+}
+
+/* Drops target i, which has died during stage. */
+static void
+target_died (struct target *targets, int i, int *count, int stage)
+{
+  if (verbose && nstages > 1)
+    fprintf (stderr, _("%s(%s%d) died after %s\n"), targets[i].name,
+	     process_group ? "pgid " : "", targets[i].id, stages[stage].name);
+  drop_target (targets, i, count);
+}
+
+/*
+ * Waits for the count targets to die during stage. Those with a pidfd are
+ * polled and noticed as soon as they exit, the others are checked once
+ * per second. The dead are dropped from targets. Returns the number of
+ * those still alive when the time of the stage, or of --wait-timeout after
+ * the last one, has passed.
+ */
+static int
+wait_for_targets (struct target *targets, int count, int stage)
+{
+  struct pollfd *fds;
+  long long deadline = stage_deadline (stage), left;
+  int i, timeout, polled;
+
+  if (!(fds = malloc (count * sizeof (struct pollfd))))
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  while (count)
+    {
+      for (i = count - 1; i >= 0; i--)
+	if (targets[i].pidfd < 0
+	    && kill (process_group ? -targets[i].id : targets[i].id, 0) < 0
+	    && errno == ESRCH)
+	  target_died (targets, i, &count, stage);
+      for (i = polled = 0; i < count; i++)
+	{
+	  /* poll skips the negative ones */
+	  fds[i].fd = targets[i].pidfd;
+	  fds[i].events = POLLIN;
+	  fds[i].revents = 0;
+	  polled += targets[i].pidfd >= 0;
+	}
+      if (!count)
+	break;
+      timeout = polled < count ? 1000 : -1;
+      if (deadline)
+	{
+	  if ((left = deadline - now_ms ()) <= 0)
+	    break;
+	  if (timeout < 0 || left < timeout)
+	    timeout = left;
+	}
+      if (poll (fds, count, timeout) < 0 && errno != EINTR)
+	{
+	  perror ("poll");
+	  exit (1);
+	}
+      /* from the end, so drop_target only moves checked targets */
+      for (i = count - 1; i >= 0; i--)
+	if (fds[i].revents)
+	  target_died (targets, i, &count, stage);
+    }
+  free (fds);
+  return count;
+}
+
+/*
+ * Waits for the count targets, which have been sent the signal of the
+ * first stage, to die. Those still alive at the end of a stage are sent
+ * the signal of the next one. Returns 1 if some survive the last stage,
+ * 0 when all are gone.
+ */
+static int
+escalate (struct target *targets, int count)
+{
+  int stage, i;
+
+  for (stage = 0; (count = wait_for_targets (targets, count, stage)); stage++)
+    {
+      if (stage == nstages - 1)
+	{
+	  for (i = count - 1; i >= 0; i--)
+	    {
+	      if (!quiet)
+		fprintf (stderr, _("%s(%s%d) is still alive\n"),
+			 targets[i].name, process_group ? "pgid " : "",
+			 targets[i].id);
+	      drop_target (targets, i, &count);
+	    }
+	  return 1;
+	}
+      for (i = count - 1; i >= 0; i--)
+	if (send_signal (targets[i].pidfd, targets[i].id,
+			 stages[stage + 1].signal) >= 0)
+	  {
+	    if (verbose)
+	      fprintf (stderr, _("Killed %s(%s%d) with signal %d\n"),
+		       targets[i].name, process_group ? "pgid " : "",
+		       targets[i].id, stages[stage + 1].signal);
+	  }
+	else if (errno == ESRCH)
+	  target_died (targets, i, &count, stage);
+	else
+	  {
+	    fprintf (stderr, "%s(%d): %s\n", targets[i].name, targets[i].id,
+		     strerror (errno));
+	    drop_target (targets, i, &count);
+	  }
+    }
+  return 0;
+}
+
+/*
+ * --cgroup signals the processes of a cgroup v2 subtree instead of those
+ * with a given name. SIGKILL goes through cgroup.kill, which kills the
+ * whole subtree at once. Other signals are sent to each process listed in
+ * the cgroup.procs files while the subtree is frozen, so none can fork
+ * meanwhile. Waiting is for cgroup.events to tell it is no longer populated.
+ */
+
+#define FREEZE_TIMEOUT 1000	/* ms to wait for the subtree to freeze */
+
+/* Opens the cgroup path, given below the cgroup2 mount or including it,
+   and sets *inside if killall itself runs in its subtree. */
+static int
+open_cgroup (const char *path, int *inside)
+{
+  FILE *file;
+  struct mntent *ent;
+  char *line = NULL, *own = NULL;
+  size_t len = 0, rel_len;
+  int root, fd;
+
+  if (!(file = setmntent ("/proc/self/mounts", "r")))
+    {
+      perror ("/proc/self/mounts");
+      exit (1);
+    }
+  while ((ent = getmntent (file)) && strcmp (ent->mnt_type, "cgroup2"))
+    ;
+  if (!ent)
+    {
+      fprintf (stderr, _("cgroup2 is not mounted\n"));
+      exit (1);
+    }
+  len = strlen (ent->mnt_dir);
+  if (!strncmp (path, ent->mnt_dir, len) && (!path[len] || path[len] == '/'))
+    path += len;
+  path += strspn (path, "/");
+  if ((root = open (ent->mnt_dir, O_RDONLY | O_DIRECTORY)) < 0)
+    {
+      perror (ent->mnt_dir);
+      exit (1);
+    }
+  endmntent (file);
+  if ((fd = openat (root, *path ? path : ".", O_RDONLY | O_DIRECTORY)) < 0
+      || faccessat (fd, "cgroup.procs", F_OK, 0) < 0)
+    {
+      perror (path);
+      exit (1);
+    }
+  (void) close (root);
+
+  /* the cgroup2 line of /proc/self/cgroup reads 0::/PATH */
+  *inside = 0;
+  if ((file = fopen (PROC_BASE "/self/cgroup", "r")))
+    {
+      len = 0;
+      while (getline (&line, &len, file) > 0)
+	if (!strncmp (line, "0::/", 4))
+	  {
+	    own = line + 4;
+	    own[strcspn (own, "\n")] = 0;
+	    break;
+	  }
+      rel_len = strlen (path);
+      while (rel_len && path[rel_len - 1] == '/')
+	rel_len--;
+      *inside = own && (!rel_len || (!strncmp (own, path, rel_len)
+				     && (!own[rel_len] || own[rel_len] == '/')));
+      free (line);
+      (void) fclose (file);
+    }
+  return fd;
+}
+
+/* Writes value to the file name of the cgroup dir_fd. Returns -1 on
+   failure. */
+static int
+write_cgroup (int dir_fd, const char *name, const char *value)
+{
+  int fd, res, err;
+
+  if ((fd = openat (dir_fd, name, O_WRONLY)) < 0)
+    return -1;
+  res = write (fd, value, strlen (value)) < 0 ? -1 : 0;
+  err = errno;
+  (void) close (fd);
+  errno = err;
+  return res;
+}
+
+/* Returns the value of key in the cgroup.events file events_fd, or -1 */
+static int
+cgroup_event (int events_fd, const char *key)
+{
+  char buf[256], *p;
+  ssize_t len;
+  size_t key_len = strlen (key);
+
+  if ((len = pread (events_fd, buf, sizeof buf - 1, 0)) < 0)
+    return -1;
+  buf[len] = 0;
+  for (p = buf; p && *p; p = strchr (p, '\n') ? strchr (p, '\n') + 1 : NULL)
+    if (!strncmp (p, key, key_len) && p[key_len] == ' ')
+      return atoi (p + key_len + 1);
+  return -1;
+}
+
+/* Waits for key of events_fd to become value, until deadline unless that
+   is 0. Returns 1 if it did. */
+static int
+wait_cgroup_event (int events_fd, const char *key, int value,
+		   long long deadline)
+{
+  struct pollfd fds;
+  long long left;
+
+  fds.fd = events_fd;
+  fds.events = POLLPRI;
+  while (cgroup_event (events_fd, key) != value)
+    {
+      left = -1;
+      if (deadline && (left = deadline - now_ms ()) <= 0)
+	return 0;
+      if (poll (&fds, 1, left > 60000 ? 60000 : left) < 0 && errno != EINTR)
+	{
+	  perror ("poll");
+	  exit (1);
+	}
+    }
+  return 1;
+}
+
+/* Sends signal to the processes of the cgroup dir_fd and of those below it.
+   Returns the number signalled. */
+static int
+signal_cgroup_procs (int dir_fd, const int signal)
+{
+  struct proc_stat ps;
+  struct dirent *de;
+  FILE *procs;
+  DIR *dir;
+  pid_t pid, self = getpid ();
+  int fd, count = 0;
+
+  if ((fd = openat (dir_fd, "cgroup.procs", O_RDONLY)) >= 0)
+    {
+      if (!(procs = fdopen (fd, "r")))
+	{
+	  perror ("fdopen");
+	  exit (1);
+	}
+      while (fscanf (procs, "%d", &pid) == 1)
+	{
+	  if (pid == self)
+	    continue;
+	  if (verbose || interactive)
+	    {
+	      if (read_proc_stat (pid, &ps) < 0)
+		continue;		/* gone meanwhile */
+	      if (interactive && !ask (ps.comm, pid, signal))
+		continue;
+	    }
+	  if (kill (pid, signal) < 0)
+	    {
+	      if (errno != ESRCH)
+		fprintf (stderr, "%d: %s\n", pid, strerror (errno));
+	      continue;
+	    }
+	  if (verbose)
+	    fprintf (stderr, _("Killed %s(%d) with signal %d\n"), ps.comm, pid,
+		     signal);
+	  count++;
+	}
+      (void) fclose (procs);
+    }
+  if ((fd = dup (dir_fd)) < 0 || !(dir = fdopendir (fd)))
+    {
+      perror ("fdopendir");
+      exit (1);
+    }
+  while ((de = readdir (dir)) != NULL)
+    if (de->d_type == DT_DIR && strcmp (de->d_name, ".")
+	&& strcmp (de->d_name, "..")
+	&& (fd = openat (dir_fd, de->d_name, O_RDONLY | O_DIRECTORY)) >= 0)
+      {
+	count += signal_cgroup_procs (fd, signal);
+	(void) close (fd);
+      }
+  (void) closedir (dir);
+  return count;
+}
+
+/* Sends signal to every process of the cgroup subtree dir_fd, unless
+   killall itself is inside it. Returns the number signalled. */
+static int
+signal_cgroup (int dir_fd, int events_fd, int inside, const int signal)
+{
+  char frozen[2] = "";
+  int fd, count;
+
+  if (signal == SIGKILL && !interactive && !inside
+      && write_cgroup (dir_fd, "cgroup.kill", "1") == 0)
+    {
+      if (verbose)
+	fprintf (stderr, _("Killed cgroup %s with signal %d\n"), cgroup,
+		 signal);
+      return 1;
+    }
+  /* leave a subtree frozen by someone else as it is */
+  if (!inside && (fd = openat (dir_fd, "cgroup.freeze", O_RDONLY)) >= 0)
+    {
+      if (read (fd, frozen, 1) < 0 || frozen[0] != '0'
+	  || write_cgroup (dir_fd, "cgroup.freeze", "1") < 0)
+	frozen[0] = 0;
+      else
+	(void) wait_cgroup_event (events_fd, "frozen", 1,
+				  now_ms () + FREEZE_TIMEOUT);
+      (void) close (fd);
+    }
+  count = signal_cgroup_procs (dir_fd, signal);
+  if (frozen[0] == '0' && write_cgroup (dir_fd, "cgroup.freeze", "0") < 0)
+    perror ("cgroup.freeze");
+  return count;
+}
+
+/*
+ * Signals the processes of the cgroup subtree given with --cgroup, going
+ * through the stages of --escalate as it stays populated.
+ */
+static int
+kill_cgroup (void)
+{
+  int dir_fd, events_fd, inside, stage;
+
+  dir_fd = open_cgroup (cgroup, &inside);
+  if ((events_fd = openat (dir_fd, "cgroup.events", O_RDONLY)) < 0)
+    {
+      perror ("cgroup.events");
+      exit (1);
+    }
+  if (!cgroup_event (events_fd, "populated"))
+    {
+      if (!quiet)
+	fprintf (stderr, _("%s: no process found\n"), cgroup);
+      return 1;
+    }
+  for (stage = 0;; stage++)
+    {
+      if (!signal_cgroup (dir_fd, events_fd, inside, stages[stage].signal)
+	  && !stage)
+	return 1;
+      if (!wait_until_dead || inside)
+	return 0;
+      if (wait_cgroup_event (events_fd, "populated", 0,
+			     stage_deadline (stage)))
+	{
+	  if (verbose && nstages > 1)
+	    fprintf (stderr, _("%s: cgroup emptied after %s\n"), cgroup,
+		     stages[stage].name);
+	  return 0;
+	}
+      if (stage == nstages - 1)
+	{
+	  if (!quiet)
+	    fprintf (stderr, _("%s: cgroup is still populated\n"), cgroup);
+	  return 1;
+	}
+    }
+}
+
+/* Tells whether pid runs the executable name, whose stat is sts. */
+static int
+match_exe (pid_t pid, const char *name, const struct stat *sts)
+{
+  const struct snapshot_record *rec;
+  struct stat st;
+  char *path, *linkbuf;
+  size_t len;
+  int ok = 1;
+
+  if (snapshot)
+    return (rec = snapshot_find (snapshot, pid)) && rec->exe_ino
+      && ((sts->st_dev == rec->exe_dev && sts->st_ino == rec->exe_ino)
+	  || !strcmp (name, snapshot_string (snapshot, rec->exe)));
+
+  if (asprintf (&path, PROC_BASE "/%d/exe", pid) < 0)
+    return 0;
+
+  if (stat (path, &st) < 0) 
+    ok = 0;
+
+  else if (sts->st_dev != st.st_dev ||
+	   sts->st_ino != st.st_ino)
+    {
+      /* maybe the binary has been modified and sts->st_ino
+       * is not reliable anymore. We need to compare paths.
+       */
+      len = strlen(name);
+      linkbuf = malloc(len + 1);
+
+      if (!linkbuf ||
+	  readlink(path, linkbuf, len + 1) != len ||
+	  memcmp(name, linkbuf, len))
+	ok = 0;
+      free(linkbuf);
+    }
+
+  free(path);
+  return ok;
+}
+
+/*
+ * Open addressing table of indices into the name list, so that a process
+ * name is looked up once instead of being compared with every name. Only
+ * the first key_len characters of a name count (-1 for all of them), and
+ * with -I their case doesn't.
+ */
+struct name_table
+{
+  int *slots;			/* -1 if empty */
+  unsigned int mask;
+  size_t key_len;
+};
+
+static unsigned int
+hash_name (const char *name, size_t key_len)
+{
+  unsigned int hash = 2166136261U;
+
+  for (; key_len && *name; key_len--, name++)
+    hash = (hash ^ (unsigned char) (ignore_case ? tolower (*name) : *name))
+      * 16777619U;
+  return hash;
+}
+
+static int
+compare_name (const char *a, const char *b, size_t key_len)
+{
+  return ignore_case ? strncasecmp (a, b, key_len) : strncmp (a, b, key_len);
+}
+
+/* Returns the index of the first name that equals key, or -1. */
+static int
+find_name (const struct name_table *table, char **namelist, const char *key)
+{
+  unsigned int slot;
+
+  for (slot = hash_name (key, table->key_len) & table->mask;
+       table->slots[slot] >= 0; slot = (slot + 1) & table->mask)
+    if (!compare_name (namelist[table->slots[slot]], key, table->key_len))
+      return table->slots[slot];
+  return -1;
+}
+
+/* Fills table with the names that are process names, not paths, and
+   have at least min_len characters. */
+static void
+build_name_table (struct name_table *table, size_t key_len, size_t min_len,
+		  int names, char **namelist, const struct stat *sts)
+{
+  unsigned int size = 16, slot;
+  int i;
+
+  while (size < 2 * (unsigned int) names)
+    size *= 2;
+  if (!(table->slots = malloc (size * sizeof (int))))
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  memset (table->slots, -1, size * sizeof (int));
+  table->mask = size - 1;
+  table->key_len = key_len;
+  for (i = 0; i < names; i++)
+    {
+      if (sts[i].st_dev || strlen (namelist[i]) < min_len)
+	continue;
+      for (slot = hash_name (namelist[i], key_len) & table->mask;
+	   table->slots[slot] >= 0; slot = (slot + 1) & table->mask)
+	if (!compare_name (namelist[table->slots[slot]], namelist[i], key_len))
+	  break;
+      /* the first of equal names is the one that is marked found */
+      if (table->slots[slot] < 0)
+	table->slots[slot] = i;
+    }
+}
+
+/*
+ * The -r patterns joined into one "(p0)|(p1)|..." so that a process name
+ * that matches none of them, the usual case, takes a single regexec.
+ * combined_groups[i] is the subexpression holding pattern i, and
+ * combined_groups[names] the number of elements of combined_match.
+ */
+static regex_t combined_regexp;
+static size_t *combined_groups = NULL;
+static regmatch_t *combined_match = NULL;	/* NULL if not combined */
+
+static void
+build_combined_regexp(int names, char **namelist, const regex_t *reglist,
+		      int flag)
+{
+	char *pattern, *p;
+	size_t len = 1;
+	int i;
+
+	for (i = 0; i < names; i++)
+	{
+		/* back-references would refer to the wrong subexpressions */
+		for (p = strchr(namelist[i], '\\'); p; p = strchr(p + 2, '\\'))
+			if (isdigit(p[1]) || !p[1])
+				return;
+		len += strlen(namelist[i]) + 3;
+	}
+	if (!(pattern = malloc(len))
+	    || !(combined_groups = malloc((names + 1) * sizeof(size_t))))
+	{
+		perror ("malloc");
+		exit (1);
+	}
+	p = pattern;
+	combined_groups[0] = 1;
+	for (i = 0; i < names; i++)
+	{
+		p += sprintf(p, "%s(%s)", i ? "|" : "", namelist[i]);
+		combined_groups[i + 1] = combined_groups[i] + reglist[i].re_nsub + 1;
+	}
+	/* a pattern that only compiles on its own is just not combined */
+	if (regcomp(&combined_regexp, pattern, flag) == 0)
+	{
+		if (combined_regexp.re_nsub + 1 != combined_groups[names])
+			regfree(&combined_regexp);
+		else if (!(combined_match = malloc(combined_groups[names]
+						    * sizeof(regmatch_t))))
+		{
+			perror ("malloc");
+			exit (1);
+		}
+	}
+	free(pattern);
 }
 
 static regex_t *
@@ -236,9 +1038,35 @@ build_regexp_list(int names, char **namelist)
 			exit (1);
 		}
 	}
+	build_combined_regexp(names, namelist, reglist, flag & ~REG_NOSUB);
 	return reglist;
 }
 
+/* Returns the first of the names regular expressions in reglist that
+   matches name, or -1. */
+static int
+match_regexp_list(int names, const regex_t *reglist, const char *name)
+{
+	int i, j;
+
+	if (combined_match)
+	{
+		if (regexec(&combined_regexp, name, combined_groups[names],
+			    combined_match, 0) != 0)
+			return -1;
+		/* some pattern matched, but maybe not the first that does */
+		for (j = 0; j < names
+			    && combined_match[combined_groups[j]].rm_so < 0; j++)
+			;
+	}
+	else
+		j = names;
+	for (i = 0; i < j; i++)
+		if (regexec(&reglist[i], name, 0, NULL, 0) == 0)
+			return i;
+	return j < names ? j : -1;
+}
+
 #ifdef WITH_SELINUX
 static int
 kill_all(int signal, int names, char **namelist, struct passwd *pwent, 
@@ -248,19 +1076,24 @@ static int
 kill_all (int signal, int names, char **namelist, struct passwd *pwent)
 #endif /*WITH_SELINUX*/
 {
-  DIR *dir;
+  DIR *dir = NULL;
   struct dirent *de;
-  FILE *file;
-  struct stat st, sts[MAX_NAMES];
-  int *name_len = NULL;
-  char *path, comm[COMM_LEN];
-  char *command_buf;
+  struct stat *sts = NULL;
+  struct name_table whole_names, long_names;
+  int *exe_names = NULL, exe_count = 0;
+  struct proc_stat ps;
+  char *comm = ps.comm;
+  char *cmdline = NULL, *arg, *end;
+  size_t cmdline_size = 0;
+  ssize_t cmdline_len;
   char *command;
-  pid_t *pid_table, pid, self, *pid_killed;
-  pid_t *pgids;
+  pid_t *pid_table, pid, self;
+  struct target *killed;
+  struct pgid_set pgids = { NULL, 0, 0 };
   int i, j, okay, length, got_long, error;
-  int pids, max_pids, pids_killed;
-  unsigned long found;
+  int pids, max_pids, pids_killed, pidfd;
+  unsigned long *found;
+  int found_names, shown;
   regex_t *reglist = NULL;;
 #ifdef WITH_SELINUX
   security_context_t lcontext=NULL;
@@ -270,7 +1103,8 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
       reglist = build_regexp_list(names, namelist);
   else if (names)
    {
-      if (!(name_len = malloc (sizeof (int) * names)))
+      if (!(exe_names = malloc (sizeof (int) * names))
+	  || !(sts = malloc (sizeof (struct stat) * names)))
         {
           perror ("malloc");
           exit (1);
@@ -278,25 +1112,28 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
       for (i = 0; i < names; i++) 
         {
           if (!strchr (namelist[i], '/'))
-            {
-	      sts[i].st_dev = 0;
-	      name_len[i] = strlen (namelist[i]);
-            }
+	    sts[i].st_dev = 0;
           else if (stat (namelist[i], &sts[i]) < 0)
             {
 	      perror (namelist[i]);
 	      exit (1);
             }
+	  else
+	    exe_names[exe_count++] = i;
         }
+      /* names are compared whole, except with a truncated comm */
+      build_name_table (&whole_names, (size_t) -1, 0, names, namelist, sts);
+      build_name_table (&long_names, COMM_LEN - 1, COMM_LEN - 1, names,
+			namelist, sts);
     } 
   self = getpid ();
-  found = 0;
-  if (!(dir = opendir (PROC_BASE)))
+  if (!(found = calloc (FOUND_WORDS (names) + 1, sizeof (unsigned long))))
     {
-      perror (PROC_BASE);
+      perror ("malloc");
       exit (1);
     }
-  max_pids = 256;
+  found_names = shown = 0;
+  max_pids = snapshot ? snapshot->header->count + 1 : 256;
   pid_table = malloc (max_pids * sizeof (pid_t));
   if (!pid_table)
     {
@@ -304,47 +1141,53 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
       exit (1);
     }
   pids = 0;
-  while ( (de = readdir (dir)) != NULL)
+  if (snapshot)
     {
-      if (!(pid = (pid_t) atoi (de->d_name)) || pid == self)
-	continue;
-      if (pids == max_pids)
+      const struct snapshot_record *rec = snapshot->records;
+
+      for (i = 0; i < snapshot->header->count; i++, rec++)
+	if (rec->tgid == rec->pid && rec->pid != self)
+	  pid_table[pids++] = rec->pid;
+    }
+  else
+    {
+      if (!(dir = opendir (PROC_BASE)))
 	{
-	  if (!(pid_table = realloc (pid_table, 2 * pids * sizeof (pid_t))))
+	  perror (PROC_BASE);
+	  exit (1);
+	}
+      while ( (de = readdir (dir)) != NULL)
+	{
+	  if (!(pid = (pid_t) atoi (de->d_name)) || pid == self)
+	    continue;
+	  if (pids == max_pids)
 	    {
-	      perror ("realloc");
-	      exit (1);
+	      if (!(pid_table = realloc (pid_table, 2 * pids * sizeof (pid_t))))
+		{
+		  perror ("realloc");
+		  exit (1);
+		}
+	      max_pids *= 2;
 	    }
-	  max_pids *= 2;
+	  pid_table[pids++] = pid;
 	}
-      pid_table[pids++] = pid;
+      /* still open for -u */
     }
-  (void) closedir (dir);
   pids_killed = 0;
-  pid_killed = malloc (max_pids * sizeof (pid_t));
-  if (!pid_killed)
+  killed = malloc (max_pids * sizeof (struct target));
+  if (!killed)
     {
       perror ("malloc");
       exit (1);
     }
-  if (!process_group)
-    pgids = NULL;		/* silence gcc */
-  else
-    {
-      pgids = calloc (pids, sizeof (pid_t));
-      if (!pgids)
-	{
-	  perror ("malloc");
-	  exit (1);
-	}
-    }
   for (i = 0; i < pids; i++)
     {
       pid_t id;
       int found_name = -1;
       double process_age_sec = 0;
       /* match by UID */
-      if (pwent && match_process_uid(pid_table[i], pwent->pw_uid)==0)
+      if (pwent && !match_process_uid (dirfd (dir), pid_table[i],
+				       pwent->pw_uid))
 	continue;
 #ifdef WITH_SELINUX
       /* match by SELinux context */
@@ -360,86 +1203,40 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
         }
 #endif /*WITH_SELINUX*/
       /* load process name */
-      if (asprintf (&path, PROC_BASE "/%d/stat", pid_table[i]) < 0)
-	continue;
-      if (!(file = fopen (path, "r"))) 
-	{
-	  free (path);
-	  continue;
-	}
-      free (path);
-      okay = fscanf (file, "%*d (%15[^)]", comm) == 1;
-      if (!okay) {
-	fclose(file);
+      if (!read_proc_stat (pid_table[i], &ps))
 	continue;
-      }
       if ( younger_than || older_than ) {
-	 rewind(file);
-	 unsigned long long proc_stt_jf = 0;
-	 okay = fscanf(file, "%*d %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %Lu", 
-		       &proc_stt_jf) == 1;
-	 if (!okay) {
-	    fclose(file);
-	    continue;
-	 }
-	 process_age_sec = process_age(proc_stt_jf);
+	 process_age_sec = process_age(ps.starttime);
 	 assert(process_age_sec > 0);
       }
-      (void) fclose (file);
        
       got_long = 0;
       command = NULL;		/* make gcc happy */
       length = strlen (comm);
       if (length == COMM_LEN - 1)
 	{
-	  if (asprintf (&path, PROC_BASE "/%d/cmdline", pid_table[i]) < 0)
+	  if ((cmdline_len = read_proc_cmdline (pid_table[i], &cmdline,
+						&cmdline_size)) < 0)
 	    continue;
-	  if (!(file = fopen (path, "r"))) {
-	    free (path);
-	    continue;
-	  }
-	  free (path);
-          while (1) {
-            /* look for actual command so we skip over initial "sh" if any */
-            char *p;
-	    int cmd_size = 128;
-	    command_buf = (char *)malloc (cmd_size);
-	    if (!command_buf)
-	      exit (1);
-
-            /* 'cmdline' has arguments separated by nulls */
-            for (p=command_buf; ; p++) {
-              int c;
-	      if (p == (command_buf + cmd_size)) 
+	  /* look for actual command so we skip over initial "sh" if any;
+	     'cmdline' has arguments separated by nulls */
+	  okay = 0;
+	  for (arg = cmdline; arg < cmdline + cmdline_len && *arg;
+	       arg = end + 1)
+	    {
+	      end = memchr (arg, 0, cmdline + cmdline_len - arg);
+	      if (!end)
+		end = cmdline + cmdline_len;
+	      if ((command = memrchr (arg, '/', end - arg)))
+		command++;
+	      else
+		command = arg;
+	      if (strncmp (command, comm, COMM_LEN - 1) == 0)
 		{
-		  int cur_size = cmd_size;
-		  cmd_size *= 2;
-		  command_buf = (char *)realloc(command_buf, cmd_size);
-		  if (!command_buf)
-		    exit (1);
-		  p = command_buf + cur_size;
+		  okay = 1;
+		  break;
 		}
-              c = fgetc(file);
-              if (c == EOF || c == '\0') {
-                *p = '\0';
-                break;
-              } else {
-                *p = c;
-              }
-            }
-            if (strlen(command_buf) == 0) {
-              okay = 0;
-              break;
-            }
-            p = strrchr(command_buf,'/');
-            p = p ? p+1 : command_buf;
-            if (strncmp(p, comm, COMM_LEN-1) == 0) {
-              okay = 1;
-              command = p;
-              break;
-            }
-          }
-          (void) fclose(file);
+	    }
 	  if (exact && !okay)
 	    {
 	      if (verbose)
@@ -450,85 +1247,32 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
 	  got_long = okay;
 	}
       /* mach by process name */
-      for (j = 0; j < names; j++)
+      if (names && reg)
+	found_name = match_regexp_list (names, reglist,
+					got_long ? command : comm);
+      else if (names)
 	{
-	  if (reg)
-	    {
-	      if (regexec (&reglist[j], got_long ? command : comm, 0, NULL, 0) != 0)
-		      continue;
-	    }
-	  else /* non-regex */
-	    {
-	      if ( younger_than && process_age_sec && (process_age_sec > younger_than ) )
-		 continue;
-	      if ( older_than   && process_age_sec && (process_age_sec < older_than ) )
-		 continue;
-	       
- 	      if (!sts[j].st_dev)
-	        {
-	          if (length != COMM_LEN - 1 || name_len[j] < COMM_LEN - 1)
-	  	    {
-		      if (ignore_case == 1)
-		        {
-		          if (strcasecmp (namelist[j], comm))
-		             continue;
-		        }
-		      else
-		        {
-		          if (strcmp(namelist[j], comm))
-		             continue;
-		        }
-		    }
-	          else
-	            {
-	              if (ignore_case == 1)
-	                {
-	                  if (got_long ? strcasecmp (namelist[j], command) :
-	                                 strncasecmp (namelist[j], comm, COMM_LEN - 1))
-	                     continue;
-	                }
-	              else
-	                {
-	                  if (got_long ? strcmp (namelist[j], command) :
-	                                 strncmp (namelist[j], comm, COMM_LEN - 1))
-	                     continue;
-	                }
-	            }
-	        }
-	      else
-	        {
-		  int ok = 1;
-
-	          if (asprintf (&path, PROC_BASE "/%d/exe", pid_table[i]) < 0)
-		    continue;
-
-	          if (stat (path, &st) < 0) 
-		      ok = 0;
-
-		  else if (sts[j].st_dev != st.st_dev ||
-			   sts[j].st_ino != st.st_ino)
-		    {
-		      /* maybe the binary has been modified and std[j].st_ino
-		       * is not reliable anymore. We need to compare paths.
-		       */
-		      size_t len = strlen(namelist[j]);
-		      char *linkbuf = malloc(len + 1);
-
-		      if (!linkbuf ||
-			  readlink(path, linkbuf, len + 1) != len ||
-			  memcmp(namelist[j], linkbuf, len))
-			ok = 0;
-		      free(linkbuf);
-		    }
-
-		  free(path);
-		  if (!ok)
-		    continue;
-	        }
-	    } /* non-regex */
-	  found_name = j;
-	  break;
-	}  
+	  if ( younger_than && process_age_sec && (process_age_sec > younger_than ) )
+	     continue;
+	  if ( older_than   && process_age_sec && (process_age_sec < older_than ) )
+	     continue;
+
+	  if (length != COMM_LEN - 1)
+	    found_name = find_name (&whole_names, namelist, comm);
+	  else if (got_long)
+	    found_name = find_name (&whole_names, namelist, command);
+	  else
+	    found_name = find_name (&long_names, namelist, comm);
+	  /* an executable listed before that name takes precedence */
+	  for (j = 0; j < exe_count
+		      && (found_name < 0 || exe_names[j] < found_name); j++)
+	    if (match_exe (pid_table[i], namelist[exe_names[j]],
+			   &sts[exe_names[j]]))
+	      {
+		found_name = exe_names[j];
+		break;
+	      }
+	}
         
         if (names && found_name==-1)
 	  continue;  /* match by process name faild */
@@ -538,77 +1282,80 @@ kill_all (int signal, int names, char **namelist, struct passwd *pwent)
 	  id = pid_table[i];
 	else
 	  {
-	    int j;
-
-	    id = getpgid (pid_table[i]);
-	    pgids[i] = id;
-	    if (id < 0)
-	      {
-	        fprintf (stderr, "getpgid(%d): %s\n", pid_table[i],
-		   strerror (errno));
-	      }
-	    for (j = 0; j < i; j++)
-	      if (pgids[j] == id)
-	        break;
-	    if (j < i)
+	    /* taken from stat, which has just been read anyway; kernel
+	       threads have none, and group 0 would be our own */
+	    id = ps.pgrp;
+	    if (id <= 0 || add_pgid (&pgids, id))
 	      continue;
 	  }	
 	if (interactive && !ask (comm, id, signal))
 	  continue;
 	if (pidof)
 	  {
-	    if (found)
+	    if (shown++)
 	       putchar (' ');
 	    printf ("%d", id);
-	    found |= 1 << (found_name >= 0 ? found_name : 0);
 	  }
-	else if (kill (process_group ? -id : id, signal) >= 0)
+	else
 	  {
+	    /* a pidfd can't end up at a new process that reuses the PID */
+	    pidfd = wait_until_dead && !process_group ? open_pidfd (id) : -1;
+	    if (send_signal (pidfd, id, signal) < 0)
+	      {
+		if (errno != ESRCH || interactive)
+		  fprintf (stderr, "%s(%d): %s\n", got_long ? command :
+			    comm, id, strerror (errno));
+		if (pidfd >= 0)
+		  (void) close (pidfd);
+		continue;
+	      }
 	    if (verbose)
 	      fprintf (stderr, _("Killed %s(%s%d) with signal %d\n"), got_long ? command :
 			 comm, process_group ? "pgid " : "", id, signal);
-	    if (found_name >= 0)
-		    /* mark item of namelist */
-		    found |= 1 << found_name;
-	    pid_killed[pids_killed++] = id;
+	    killed[pids_killed].id = id;
+	    killed[pids_killed].pidfd = pidfd;
+	    if (!(killed[pids_killed++].name = strdup (got_long ? command : comm)))
+	      {
+		perror ("strdup");
+		exit (1);
+	      }
+	  }
+	/* mark item of namelist */
+	if (found_name >= 0 && !IS_FOUND (found, found_name))
+	  {
+	    found[found_name / FOUND_BITS] |= 1UL << found_name % FOUND_BITS;
+	    found_names++;
 	  }
-	else if (errno != ESRCH || interactive)
-	  fprintf (stderr, "%s(%d): %s\n", got_long ? command :
-	    	comm, id, strerror (errno));
+    }
+  free (cmdline);
+  if (names && !reg)
+    {
+      free (exe_names);
+      free (sts);
+      free (whole_names.slots);
+      free (long_names.slots);
     }
   if (!quiet && !pidof)
     for (i = 0; i < names; i++)
-      if (!(found & (1 << i)))
+      if (!IS_FOUND (found, i))
 	fprintf (stderr, _("%s: no process found\n"), namelist[i]);
   if (pidof)
     putchar ('\n');
   if (names)
     /* killall returns a zero return code if at least one process has 
      * been killed for each listed command. */
-    error = found == ((1 << (names - 1)) | ((1 << (names - 1)) - 1)) ? 0 : 1;
+    error = found_names == names ? 0 : 1;
   else
     /* in nameless mode killall returns a zero return code if at least 
      * one process has killed */
     error = pids_killed ? 0 : 1;
-  /*
-   * We scan all (supposedly) killed processes every second to detect dead
-   * processes as soon as possible in order to limit problems of race with
-   * PID re-use.
-   */
-  while (pids_killed && wait_until_dead)
-    {
-      for (i = 0; i < pids_killed;)
-	{
-	  if (kill (process_group ? -pid_killed[i] : pid_killed[i], 0) < 0 &&
-	      errno == ESRCH)
-	    {
-	      pid_killed[i] = pid_killed[--pids_killed];
-	      continue;
-	    }
-	  i++;
-	}
-      sleep (1);		/* wait a bit longer */
-    }
+  free (found);
+  free (pgids.slots);
+  if (dir)
+    (void) closedir (dir);
+  if (wait_until_dead && pids_killed && escalate (killed, pids_killed))
+    error = 1;
+  free (killed);
   return error;
 }
 
@@ -617,12 +1364,17 @@ static void
 usage_pidof (void)
 {
   fprintf (stderr, _(
-    "Usage: pidof [ -eg ] NAME...\n"
+    "Usage: pidof [ -eg ] [ --snapshot FILE ] NAME...\n"
+    "       pidof --save-snapshot FILE\n"
     "       pidof -V\n\n"
     "    -e      require exact match for very long names;\n"
     "            skip if the command line is unavailable\n"
     "    -g      show process group ID instead of process ID\n"
-    "    -V      display version information\n\n"));
+    "    -V      display version information\n"
+    "    --save-snapshot FILE\n"
+    "            save all processes to FILE and exit\n"
+    "    --snapshot FILE\n"
+    "            look the names up in FILE instead of /proc\n\n"));
 }
 
 
@@ -654,7 +1406,13 @@ usage_killall (const char *msg)
     "  -u,--user USER      kill only process(es) running as USER\n"
     "  -v,--verbose        report if the signal was successfully sent\n"
     "  -V,--version        display version information\n"
-    "  -w,--wait           wait for processes to die\n"));
+    "  -w,--wait           wait for processes to die\n"
+    "  --wait-timeout TIME wait for processes to die, but only for TIME\n"
+    "  --escalate POLICY   send the signals of POLICY in turn to processes\n"
+    "                      still alive, as in TERM:10s,INT:5s,KILL\n"
+    "  --cgroup DIR        kill all processes of the cgroup v2 DIR and below\n"
+    "  --save-snapshot FILE\n"
+    "                      save all processes to FILE for pidof and exit\n"));
 #ifdef WITH_SELINUX
   fprintf(stderr, _(
     "  -Z,--context REGEXP kill only process(es) having context\n"
@@ -697,6 +1455,45 @@ have_proc_self_stat (void)
   return stat(filename, &isproc) == 0;
 }
 
+/*
+ * Parses an --escalate policy like TERM:10s,INT:5s,KILL into stages.
+ * Every stage but the last needs a time.
+ */
+static void
+parse_escalation (char *policy)
+{
+  char *step, *time;
+  int i;
+
+  if (!(policy = strdup (policy)))
+    {
+      perror ("strdup");
+      exit (1);
+    }
+  for (step = strtok (policy, ","); step; step = strtok (NULL, ","))
+    {
+      if (!(stages = realloc (stages, (nstages + 1) * sizeof (struct stage))))
+	{
+	  perror ("realloc");
+	  exit (1);
+	}
+      if ((time = strchr (step, ':')))
+	*time++ = 0;
+      stages[nstages].name = step;
+      stages[nstages].signal = get_signal (step, "killall");
+      stages[nstages].timeout = 0;
+      if (time && 0 >= (stages[nstages].timeout = parse_time_units (time)))
+	usage (_("Invalid time format"));
+      nstages++;
+    }
+  for (i = 0; i < nstages - 1; i++)
+    if (!stages[i].timeout)
+      usage (_("Invalid escalation policy"));
+  if (!nstages)
+    usage (_("Invalid escalation policy"));
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -724,10 +1521,15 @@ main (int argc, char **argv)
     {"user", 1, NULL, 'u'},
     {"verbose", 0, NULL, 'v'},
     {"wait", 0, NULL, 'w'},
+    {"wait-timeout", 1, NULL, OPT_WAIT_TIMEOUT},
+    {"escalate", 1, NULL, OPT_ESCALATE},
+    {"cgroup", 1, NULL, OPT_CGROUP},
 #ifdef WITH_SELINUX
     {"context", 1, NULL, 'Z'},
 #endif /*WITH_SELINUX*/
     {"version", 0, NULL, 'V'},
+    {"snapshot", 1, NULL, OPT_SNAPSHOT},
+    {"save-snapshot", 1, NULL, OPT_SAVE_SNAPSHOT},
     {0,0,0,0 }};
 
   /* Setup the i18n */
@@ -842,6 +1644,29 @@ main (int argc, char **argv)
         fprintf(stderr, "Warning: -Z (--context) ignored. Requires an SELinux enabled kernel\n");
       break;
 #endif /*WITH_SELINUX*/
+    case OPT_WAIT_TIMEOUT:
+      NOT_PIDOF_OPTION;
+      if ( 0 >= (wait_timeout = parse_time_units(optarg) ) )
+	    usage(_("Invalid time format"));
+      wait_until_dead = 1;
+      break;
+    case OPT_ESCALATE:
+      NOT_PIDOF_OPTION;
+      parse_escalation (optarg);
+      wait_until_dead = 1;
+      break;
+    case OPT_CGROUP:
+      NOT_PIDOF_OPTION;
+      cgroup = optarg;
+      break;
+    case OPT_SNAPSHOT:
+      if (!pidof)
+	usage (_("Only pidof can look names up in a snapshot"));
+      snapshot = snapshot_open (optarg);
+      break;
+    case OPT_SAVE_SNAPSHOT:
+      snapshot_save (optarg);
+      return 0;
     case '?':
       /* Signal names are in uppercase, so check to see if the argv
        * is upper case */
@@ -859,22 +1684,30 @@ main (int argc, char **argv)
     }
   }
   myoptind = optind;
+  if (cgroup && (argc - myoptind > 0 || pwent))
+    usage (_("--cgroup selects the processes itself"));
 #ifdef WITH_SELINUX
-  if ((argc - myoptind < 1) && pwent==NULL && scontext==NULL) 
+  if ((argc - myoptind < 1) && pwent==NULL && scontext==NULL && !cgroup)
 #else
-  if ((argc - myoptind < 1) && pwent==NULL)	  
+  if ((argc - myoptind < 1) && pwent==NULL && !cgroup)
 #endif
     usage(NULL);
 
-  if (argc - myoptind > MAX_NAMES + 1) {
-    fprintf (stderr, _("Maximum number of names is %d\n"), MAX_NAMES);
-    exit (1);
-  }
-  if (!have_proc_self_stat()) {
+  if (!snapshot && !have_proc_self_stat()) {
     fprintf (stderr, _("%s lacks process entries (not mounted ?)\n"), PROC_BASE);
     exit (1);
   }
   argv = argv + myoptind;
+  if (nstages)
+    sig_num = stages[0].signal;	/* --escalate overrides the signal */
+  else
+    {
+      single_stage.signal = sig_num;
+      stages = &single_stage;
+      nstages = 1;
+    }
+  if (cgroup)
+    return kill_cgroup ();
   /*printf("sending signal %d to procs\n", sig_num);*/
 #ifdef WITH_SELINUX
   return kill_all(sig_num,argc - myoptind, argv, pwent, 
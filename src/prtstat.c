@@ -38,10 +38,12 @@
 
 #include "i18n.h"
 #include "prtstat.h"
+#include "snapshot.h"
 
 #define NORETURN __attribute__((__noreturn__))
 
 static long sc_clk_tck;
+static struct snapshot *snapshot = NULL;	/* --snapshot */
 
 static void usage(const char *errormsg) NORETURN;
 
@@ -56,6 +58,10 @@ static void usage(const char *errormsg)
 	   "Print information about a process\n"
 	   "    -r,--raw       Raw display of information\n"
 	   "    -V,--version   Display version information and exit\n"
+	   "    --save-snapshot FILE\n"
+	   "                   Save all processes to FILE and exit\n"
+	   "    --snapshot FILE\n"
+	   "                   Show the processes saved in FILE\n"
 	  ));
   exit(1);
 }
@@ -207,16 +213,27 @@ static void print_formated_stat(const int pid,struct proc_info *pr)
 
 
 }
-static void print_stat(const int pid, const opt_type options)
+/* Opens the stat file of pid, or with --snapshot the copy saved there */
+static FILE *open_stat(const int pid)
 {
+  const struct snapshot_record *rec;
+  const char *line;
   char *pathname;
-  char buf[BUFSIZ];
-  char *bptr;
   FILE *fp;
 
-  struct proc_info *pr;
-  pr = malloc(sizeof(struct proc_info));
-
+  if (snapshot) {
+	rec = snapshot_find(snapshot, pid);
+	if (rec == NULL || rec->tgid != pid) {
+	  fprintf(stderr, _("Process with pid %d does not exist.\n"), pid);
+	  return NULL;
+	}
+	line = snapshot_string(snapshot, rec->stat);
+	if ( (fp = fmemopen((void *) line, strlen(line) + 1, "r")) == NULL) {
+	  perror("fmemopen");
+	  exit(1);
+	}
+	return fp;
+  }
   if ( (asprintf(&pathname, "/proc/%d/stat",(int)pid)) < 0) {
 	perror(_("asprintf in print_stat failed.\n"));
 	exit(1);
@@ -226,10 +243,22 @@ static void print_stat(const int pid, const opt_type options)
 	  fprintf(stderr, _("Process with pid %d does not exist.\n"), pid);
 	else
 	  fprintf(stderr, _("Unable to open stat file for pid %d (%s)\n"),(int)pid,strerror(errno));
-	free(pathname);
-	return;
   }
   free(pathname);
+  return fp;
+}
+
+static void print_stat(const int pid, const opt_type options)
+{
+  char buf[BUFSIZ];
+  char *bptr;
+  FILE *fp;
+
+  struct proc_info *pr;
+  pr = malloc(sizeof(struct proc_info));
+
+  if ( (fp = open_stat(pid)) == NULL)
+	return;
 
   fgets(buf,BUFSIZ,fp);
   bptr = strchr(buf, '(');
@@ -286,6 +315,8 @@ int main(int argc, char *argv[])
   struct option options[] = {
 	{"raw"		,0, NULL, 'r' },
 	{"version", 0, NULL, 'V'},
+	{"snapshot", 1, NULL, OPT_SNAPSHOT},
+	{"save-snapshot", 1, NULL, OPT_SAVE_SNAPSHOT},
 	{ 0, 0, 0, 0}
   };
 
@@ -304,6 +335,12 @@ int main(int argc, char *argv[])
 	  case 'V':
 		print_version();
 		return 0;
+	  case OPT_SNAPSHOT:
+		snapshot = snapshot_open(optarg);
+		break;
+	  case OPT_SAVE_SNAPSHOT:
+		snapshot_save(optarg);
+		return 0;
 	  case '?':
 		usage(_("Invalid option"));
 		break;
@@ -312,7 +349,7 @@ int main(int argc, char *argv[])
   if (argc <= optind)
 	usage(_("You must provide at least one PID."));
 
-  if (stat("/proc/self/stat", &st) == -1)
+  if (snapshot == NULL && stat("/proc/self/stat", &st) == -1)
   {
 	fprintf(stderr, _("/proc is not mounted, cannot stat /proc/self/stat.\n"));
 	exit(1);
@@ -2,6 +2,10 @@
 typedef unsigned char opt_type;
 #define OPT_RAW 1
 
+/* Long options without a short form */
+#define OPT_SNAPSHOT 256
+#define OPT_SAVE_SNAPSHOT 257
+
 struct proc_info
 {
   char *comm;
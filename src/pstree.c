@@ -38,12 +38,26 @@
 #include <termios.h>
 #include <langinfo.h>
 #include <assert.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_LINUX_CN_PROC_H
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif                                /*HAVE_LINUX_CN_PROC_H */
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif                                /*HAVE_PTHREAD_H */
 
 #include "i18n.h"
 #include "comm.h"
+#include "pwcache.h"
+#include "snapshot.h"
 
 #ifdef WITH_SELINUX
 #include <selinux/selinux.h>
@@ -52,6 +66,7 @@
 extern const char *__progname;
 
 #define PROC_BASE    "/proc"
+#define CGROUP_BASE  "/sys/fs/cgroup"
 
 /* UTF-8 defines by Johan Myreen, updated by Ben Winslow */
 #define UTF_V        "\342\224\202"        /* U+2502, Vertical line drawing char */
@@ -68,9 +83,23 @@ extern const char *__progname;
 #define VT_UR        "m"
 #define        VT_HD        "w"
 
+/* Resource figures of -R, taken from the stat line read anyway */
+struct rollup {
+    unsigned long rss;          /* in pages */
+    unsigned long long cpu;     /* utime + stime, in clock ticks */
+    long threads;
+};
+
+/* A pid namespace met with -P, see read_ns_pid */
+struct pid_ns {
+    ino_t ino;                  /* inode of /proc/PID/ns/pid */
+    struct pid_ns *next;
+};
+
 typedef struct _proc {
     char comm[COMM_LEN + 1];
     char **argv;                /* only used : argv[0] is 1st arg; undef if argc < 1 */
+    int *argw;                        /* with -a   : printed width of each argument       */
     int argc;                        /* with -a   : number of arguments, -1 if swapped    */
     pid_t pid;
     uid_t uid;
@@ -78,19 +107,31 @@ typedef struct _proc {
     security_context_t scontext;
 #endif                                /*WITH_SELINUX */
     char flags;
-    struct _child *children;
+    struct _proc **children;    /* sorted slice of child_table */
+    int nchildren;
+    int count;                  /* identical siblings folded into this one */
+    unsigned int hash;          /* structural hash of the subtree, see hash_tree */
+    struct rollup own;          /* zero for threads and unread processes */
+    struct rollup total;        /* own plus all descendants, see roll_up */
+    char *cgroup_name;          /* with -C, the name of a cgroup node */
+    struct _proc *cgroup;       /* with -C, the cgroup node it is in */
+    struct pid_ns *ns;          /* with -P, its pid namespace if known */
+    pid_t ns_pid;               /* with -P, pid in that namespace, or 0 */
     struct _proc *parent;
     struct _proc *next;
+    struct _proc *hash_next;
 } PROC;
 
 /* For flags above */
 #define PFLAG_HILIGHT   0x01
 #define PFLAG_THREAD    0x02
+#define PFLAG_DIRTY     0x04    /* to be read again, see update_tree */
+#define PFLAG_DEAD      0x08    /* exited, no longer in proc_hash */
+#define PFLAG_EXITING   0x10    /* exited, see update_tree */
+#define PFLAG_CGROUP    0x20    /* a cgroup, not a process, see read_cgroups */
 
-typedef struct _child {
-    PROC *child;
-    struct _child *next;
-} CHILD;
+/* Pseudo PID of the root cgroup node; the others count down from it */
+#define CGROUP_ROOT     (-1)
 
 static struct {
     const char *empty_2;        /*    */
@@ -117,13 +158,52 @@ static struct {
 
 static PROC *list = NULL;
 
+/*
+ * PROCs and argv strings are carved from a bump arena
+ * of large chunks, so the whole tree is released at once by free_tree.
+ */
+#define ARENA_CHUNK_SIZE 65536
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t used;
+    size_t size;
+};
+
+static struct arena_chunk *arena = NULL;
+
+/* PID lookup table, chained through hash_next; size is a power of two */
+static PROC **proc_hash = NULL;
+static int proc_hash_size = 0;
+static int proc_count = 0;
+
+/* Storage for all children arrays, filled in by link_children */
+static PROC **child_table = NULL;
+static int child_table_size = 0;
+
+/* Open addressing table used by compact_children, reused for every parent */
+static PROC **group_table = NULL;
+static int group_capacity = 0;
+
 /* The buffers will be dynamically increased in size as needed. */
 static int capacity = 0;
 static int *width = NULL;
 static int *more = NULL;
+static int *prefix_end = NULL;        /* end of each level in prefix */
+static int *prefix_cols = NULL;        /* columns up to that end */
+
+/*
+ * Drawing of the levels above the current parent, see cache_prefix, and
+ * the line being rendered, written out by out_newline.
+ */
+static char *prefix = NULL;
+static int prefix_size = 0;
+static char *line = NULL;
+static int line_len = 0, line_size = 0;
 
 static int print_args = 0, compact = 1, user_change = 0, pids = 0,
-    show_parents = 0, by_pid = 0, trunc = 1, wait_end = 0;
+    show_parents = 0, by_pid = 0, trunc = 1, wait_end = 0, hide_threads = 0,
+    numeric_uids = 0, show_rollups = 0, show_cgroups = 0, show_ns_pids = 0;
 #ifdef WITH_SELINUX
 static int show_scontext = 0;
 #endif                                /*WITH_SELINUX */
@@ -131,6 +211,34 @@ static int output_width = 132;
 static int cur_x = 1;
 static char last_char = 0;
 static int dumped = 0;                /* used by dump_by_user */
+
+/* Output formats other than the drawn tree, see dump_record */
+#define FORMAT_TEXT     0
+#define FORMAT_JSON     1               /* one nested array of objects */
+#define FORMAT_NDJSON   2               /* one object per line */
+#define FORMAT_TSV      3               /* one tab separated line per process */
+
+static int output_format = FORMAT_TEXT;
+
+/* Rollup keys of -S, see compare_children */
+#define SORT_NONE       0
+#define SORT_RSS        1
+#define SORT_CPU        2
+#define SORT_THREADS    3
+
+static int sort_key = SORT_NONE;
+static long page_size, clk_tck;         /* units of struct rollup */
+
+/* PID namespaces seen by -P, and the one we run in */
+static struct pid_ns *pid_namespaces = NULL;
+static struct pid_ns *own_pid_ns = NULL;
+
+static const char *input_name = NULL;        /* read instead of /proc */
+static const char *snapshot_name = NULL;        /* likewise */
+
+/* Long options without a short form */
+#define OPT_SNAPSHOT            256
+#define OPT_SAVE_SNAPSHOT       257
 static int charlen = 0;                /* length of character */
 
 /*
@@ -155,11 +263,20 @@ static void ensure_buffer_capacity(int index)
             perror("realloc");
             exit(1);
         }
+        if (!(prefix_end = realloc(prefix_end, capacity * sizeof(int)))) {
+            perror("realloc");
+            exit(1);
+        }
+        if (!(prefix_cols = realloc(prefix_cols, capacity * sizeof(int)))) {
+            perror("realloc");
+            exit(1);
+        }
     }
 }
 
 /*
- * Frees any buffers allocated by ensure_buffer_capacity.
+ * Frees any buffers allocated by ensure_buffer_capacity and
+ * compact_children.
  */
 static void free_buffers()
 {
@@ -171,7 +288,93 @@ static void free_buffers()
         free(more);
         more = NULL;
     }
+    free(prefix_end);
+    prefix_end = NULL;
+    free(prefix_cols);
+    prefix_cols = NULL;
     capacity = 0;
+    free(prefix);
+    prefix = NULL;
+    prefix_size = 0;
+    free(line);
+    line = NULL;
+    line_len = line_size = 0;
+    free(group_table);
+    group_table = NULL;
+    group_capacity = 0;
+}
+
+/*
+ * Returns size bytes of pointer aligned storage from the arena.  Requests
+ * larger than a chunk get a chunk of their own.
+ */
+static void *arena_alloc(size_t size)
+{
+    struct arena_chunk *chunk;
+    size_t chunk_size;
+    void *ptr;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (!arena || arena->used + size > arena->size) {
+        chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        if (!(chunk = malloc(sizeof(struct arena_chunk) + chunk_size))) {
+            perror("malloc");
+            exit(1);
+        }
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        chunk->next = arena;
+        arena = chunk;
+    }
+    ptr = (char *) (arena + 1) + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+/*
+ * Releases every process of the tree along with the PID lookup table.
+ */
+static void free_tree(void)
+{
+    struct arena_chunk *chunk;
+
+    while ((chunk = arena)) {
+        arena = chunk->next;
+        free(chunk);
+    }
+    free(proc_hash);
+    proc_hash = NULL;
+    proc_hash_size = proc_count = 0;
+    list = NULL;
+    free(child_table);
+    child_table = NULL;
+    child_table_size = 0;
+}
+
+/*
+ * Appends bytes to the current line without counting them as columns.
+ * Also used as the putc function for tputs.
+ */
+static void out_raw(const char *str, int len)
+{
+    if (line_len + len > line_size) {
+        while (line_len + len > line_size)
+            line_size = line_size ? line_size * 2 : 256;
+        if (!(line = realloc(line, line_size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(line + line_len, str, len);
+    line_len += len;
+}
+
+static int out_tputs(int c)
+{
+    char ch = c;
+
+    out_raw(&ch, 1);
+    return c;
 }
 
 static void out_char(char c)
@@ -192,32 +395,72 @@ static void out_char(char c)
     }
     charlen--;
     if (!trunc || cur_x <= output_width)
-        putchar(c);
+        out_raw(&c, 1);
     else {
         if (trunc && (cur_x == output_width + 1))
-            putchar('+');
+            out_raw("+", 1);
+    }
+}
+
+
+/*
+ * Same as calling out_char for each of the len bytes of str, but runs of
+ * ASCII are copied as a whole.
+ */
+static void out_chars(const char *str, int len)
+{
+    const char *end = str + len, *run;
+    int room;
+
+    while (str < end) {
+        if (charlen || (*str & 0x80)) {
+            out_char(*str++);
+            continue;
+        }
+        for (run = str; run < end && !(*run & 0x80); run++) ;
+        room = trunc ? output_width - cur_x : run - str;
+        if (room > run - str)
+            room = run - str;
+        if (room > 0) {
+            out_raw(str, room);
+            cur_x += room;
+            str += room;
+        } else if (cur_x > output_width) {
+            cur_x += run - str;
+            str = run;
+        } else
+            out_char(*str++);
     }
 }
 
 
 static void out_string(const char *str)
 {
-    while (*str)
-        out_char(*str++);
+    out_chars(str, strlen(str));
+}
+
+
+static void out_spaces(int count)
+{
+    static const char spaces[] = "                                ";
+    int len;
+
+    for (; count > 0; count -= len) {
+        len = count < (int) sizeof(spaces) - 1 ? count : (int) sizeof(spaces) - 1;
+        out_chars(spaces, len);
+    }
 }
 
 
 static int out_int(int x)
 {                                /* non-negative integers only */
+    char buf[3 * sizeof(int)];
     int digits, div;
 
-    digits = 0;
-    for (div = 1; x / div; div *= 10)
-        digits++;
-    if (!digits)
-        digits = 1;
-    for (div /= 10; div; div /= 10)
-        out_char('0' + (x / div) % 10);
+    for (div = 1; x / div >= 10; div *= 10) ;
+    for (digits = 0; div; div /= 10)
+        buf[digits++] = '0' + (x / div) % 10;
+    out_chars(buf, digits);
     return digits;
 }
 
@@ -234,23 +477,110 @@ static void out_scontext(security_context_t scontext)
 static void out_newline(void)
 {
     if (last_char && cur_x == output_width)
-        putchar(last_char);
+        out_raw(&last_char, 1);
     last_char = 0;
-    putchar('\n');
+    out_raw("\n", 1);
+    fwrite(line, 1, line_len, stdout);
+    line_len = 0;
     cur_x = 1;
 }
 
+/*
+ * Counts the columns out_char advances for str.
+ */
+static int str_cols(const char *str)
+{
+    int cols = 0;
+
+    for (; *str; str++)
+        if ((*str & 0xc0) != 0x80)
+            cols++;
+    return cols;
+}
+
+/*
+ * Appends the drawing for level to the prefix cache, once more[level + 1]
+ * is known.  Lines further down only copy the cached levels.
+ */
+static void cache_prefix(int level)
+{
+    const char *tail = more[level + 1] ? sym->vert_2 : sym->empty_2;
+    int start = level ? prefix_end[level - 1] : 0;
+    int spaces = width[level] + 1, len = strlen(tail);
+
+    if (start + spaces + len > prefix_size) {
+        while (start + spaces + len > prefix_size)
+            prefix_size = prefix_size ? prefix_size * 2 : 256;
+        if (!(prefix = realloc(prefix, prefix_size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memset(prefix + start, ' ', spaces);
+    memcpy(prefix + start + spaces, tail, len);
+    prefix_end[level] = start + spaces + len;
+    prefix_cols[level] = (level ? prefix_cols[level - 1] : 0) + spaces +
+        str_cols(tail);
+}
+
+/*
+ * Draws the tree lines in front of a process at level.
+ */
+static void out_prefix(int level, int last)
+{
+    if (level > 1) {
+        if (!trunc || cur_x + prefix_cols[level - 2] <= output_width) {
+            out_raw(prefix, prefix_end[level - 2]);
+            cur_x += prefix_cols[level - 2];
+        } else
+            out_chars(prefix, prefix_end[level - 2]);
+    }
+    out_spaces(width[level - 1] + 1);
+    out_string(last ? sym->last_2 : sym->branch_2);
+}
+
+
+#define PID_HASH(pid, size) (((unsigned int) (pid) * 2654435761U) & ((size) - 1))
 
 static PROC *find_proc(pid_t pid)
 {
     PROC *walk;
 
-    for (walk = list; walk; walk = walk->next)
+    if (!proc_hash)
+        return NULL;
+    for (walk = proc_hash[PID_HASH(pid, proc_hash_size)]; walk;
+         walk = walk->hash_next)
         if (walk->pid == pid)
             break;
     return walk;
 }
 
+/*
+ * Doubles the PID lookup table once it holds more processes than buckets,
+ * keeping the chains short.
+ */
+static void grow_proc_hash(void)
+{
+    PROC *walk;
+    unsigned int bucket;
+
+    if (proc_count < proc_hash_size)
+        return;
+    proc_hash_size = proc_hash_size ? proc_hash_size * 2 : 1024;
+    free(proc_hash);
+    if (!(proc_hash = calloc(proc_hash_size, sizeof(PROC *)))) {
+        perror("calloc");
+        exit(1);
+    }
+    for (walk = list; walk; walk = walk->next) {
+        if (walk->flags & PFLAG_DEAD)
+            continue;
+        bucket = PID_HASH(walk->pid, proc_hash_size);
+        walk->hash_next = proc_hash[bucket];
+        proc_hash[bucket] = walk;
+    }
+}
+
 #ifdef WITH_SELINUX
 static PROC *new_proc(const char *comm, pid_t pid, uid_t uid,
                       security_context_t scontext)
@@ -259,47 +589,149 @@ static PROC *new_proc(const char *comm, pid_t pid, uid_t uid)
 #endif                                /*WITH_SELINUX */
 {
     PROC *new;
+    unsigned int bucket;
 
-    if (!(new = malloc(sizeof(PROC)))) {
-        perror("malloc");
-        exit(1);
-    }
+    new = arena_alloc(sizeof(PROC));
     strcpy(new->comm, comm);
     new->pid = pid;
     new->uid = uid;
     new->flags = 0;
     new->argc = 0;
     new->argv = NULL;
+    new->argw = NULL;
 #ifdef WITH_SELINUX
     new->scontext = scontext;
 #endif                                /*WITH_SELINUX */
     new->children = NULL;
+    new->nchildren = 0;
+    new->count = 0;
+    new->hash = 0;
+    memset(&new->own, 0, sizeof(new->own));
+    new->cgroup_name = NULL;
+    new->cgroup = NULL;
+    new->ns = NULL;
+    new->ns_pid = 0;
     new->parent = NULL;
+    proc_count++;
+    grow_proc_hash();           /* before new is on list, or it's rehashed */
     new->next = list;
-    return list = new;
+    list = new;
+    bucket = PID_HASH(pid, proc_hash_size);
+    new->hash_next = proc_hash[bucket];
+    return proc_hash[bucket] = new;
+}
+
+
+/*
+ * Returns the name shown for proc: its comm, or the whole name of a cgroup.
+ */
+static const char *proc_name(const PROC * proc)
+{
+    return proc->cgroup_name ? proc->cgroup_name : proc->comm;
 }
 
+static unsigned long long rollup_key(const PROC * proc)
+{
+    switch (sort_key) {
+    case SORT_RSS:
+        return proc->total.rss;
+    case SORT_CPU:
+        return proc->total.cpu;
+    case SORT_THREADS:
+        return proc->total.threads;
+    }
+    return 0;
+}
 
-static void add_child(PROC * parent, PROC * child)
+static int compare_children(const void *a, const void *b)
 {
-    CHILD *new, **walk;
+    const PROC *pa = *(PROC * const *) a, *pb = *(PROC * const *) b;
+    unsigned long long ka, kb;
     int cmp;
 
-    if (!(new = malloc(sizeof(CHILD)))) {
-        perror("malloc");
-        exit(1);
+    if (sort_key && (ka = rollup_key(pa)) != (kb = rollup_key(pb)))
+        return ka > kb ? -1 : 1;        /* biggest first */
+    if (!by_pid) {
+        if ((cmp = strcmp(proc_name(pa), proc_name(pb))))
+            return cmp;
+        if (pa->uid != pb->uid)
+            return pa->uid < pb->uid ? -1 : 1;
     }
-    new->child = child;
-    for (walk = &parent->children; *walk; walk = &(*walk)->next)
-        if (by_pid) {
-            if ((*walk)->child->pid > child->pid)
-                break;
-        } else if ((cmp = strcmp((*walk)->child->comm, child->comm)) > 0)
-            break;
-        else if (!cmp && (*walk)->child->uid > child->uid)
-            break;
-    new->next = *walk;
-    *walk = new;
+    return pa->pid < pb->pid ? -1 : pa->pid > pb->pid;
+}
+
+/*
+ * Adds up the figures of -R over the subtree of current, children first.
+ */
+static void roll_up(PROC * current)
+{
+    PROC *child;
+    int i;
+
+    current->total = current->own;
+    for (i = 0; i < current->nchildren; i++) {
+        child = current->children[i];
+        roll_up(child);
+        current->total.rss += child->total.rss;
+        current->total.cpu += child->total.cpu;
+        current->total.threads += child->total.threads;
+    }
+}
+
+/*
+ * Builds the children arrays from the parent pointers set up by add_proc,
+ * adds up the rollups if they are shown or sorted by, and sorts each
+ * children array once.  All arrays are slices of one table.
+ * Expects nchildren to be 0 everywhere, as left by new_proc.
+ */
+static void link_children(void)
+{
+    PROC *walk, **slot;
+    int linked = 0;
+
+    for (walk = list; walk; walk = walk->next)
+        if (walk->parent) {
+            walk->parent->nchildren++;
+            linked++;
+        }
+    if (linked > child_table_size) {
+        child_table_size = linked;
+        free(child_table);
+        if (!(child_table = malloc(linked * sizeof(PROC *)))) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    slot = child_table;
+    for (walk = list; walk; walk = walk->next) {
+        walk->children = slot;
+        slot += walk->nchildren;
+        walk->nchildren = 0;
+    }
+    for (walk = list; walk; walk = walk->next)
+        if (walk->parent)
+            walk->parent->children[walk->parent->nchildren++] = walk;
+    if (show_rollups || sort_key)
+        for (walk = list; walk; walk = walk->next)
+            if (!walk->parent)
+                roll_up(walk);
+    for (walk = list; walk; walk = walk->next)
+        if (walk->nchildren > 1)
+            qsort(walk->children, walk->nchildren, sizeof(PROC *),
+                  compare_children);
+}
+
+
+/*
+ * Returns the number of columns out_args uses for str.
+ */
+static int args_width(const char *str)
+{
+    int len = 0;
+
+    for (; *str; str++)
+      len += *str >= ' ' && *str <= '~' ? 1 : 4;
+    return len;
 }
 
 
@@ -318,27 +750,24 @@ static void set_args(PROC * this, const char *args, int size)
             this->argc++;
     if (!this->argc)
         return;
-    if (!(this->argv = malloc(sizeof(char *) * this->argc))) {
-        perror("malloc");
-        exit(1);
-    }
+    this->argv = arena_alloc(sizeof(char *) * this->argc);
+    this->argw = arena_alloc(sizeof(int) * this->argc);
     start = strchr(args, 0) + 1;
     size -= start - args;
-    if (!(this->argv[0] = malloc((size_t) size))) {
-        perror("malloc");
-        exit(1);
-    }
+    this->argv[0] = arena_alloc((size_t) size);
     start = memcpy(this->argv[0], start, (size_t) size);
     for (i = 1; i < this->argc; i++)
         this->argv[i] = start = strchr(start, 0) + 1;
+    for (i = 0; i < this->argc; i++)
+        this->argw[i] = args_width(this->argv[i]);
 }
 
 #ifdef WITH_SELINUX
-static void
+static PROC *
 add_proc(const char *comm, pid_t pid, pid_t ppid, uid_t uid,
          const char *args, int size, char isthread, security_context_t scontext)
 #else                                /*WITH_SELINUX */
-static void
+static PROC *
 add_proc(const char *comm, pid_t pid, pid_t ppid, uid_t uid,
          const char *args, int size, char isthread)
 #endif                                /*WITH_SELINUX */
@@ -367,30 +796,109 @@ add_proc(const char *comm, pid_t pid, pid_t ppid, uid_t uid,
 #else                                /*WITH_SELINUX */
         parent = new_proc("?", ppid, 0);
 #endif                                /*WITH_SELINUX */
-    add_child(parent, this);
     this->parent = parent;
+    return this;
+}
+
+/*
+ * Drops an exited process from the PID lookup table.  It stays on list,
+ * marked dead and detached from its parent, until the tree is freed.
+ */
+static void remove_proc(PROC * this)
+{
+    PROC **walk;
+
+    for (walk = &proc_hash[PID_HASH(this->pid, proc_hash_size)]; *walk;
+         walk = &(*walk)->hash_next)
+        if (*walk == this) {
+            *walk = this->hash_next;
+            break;
+        }
+    this->flags |= PFLAG_DEAD;
+    this->parent = NULL;
+    proc_count--;
 }
 
 
 static int tree_equal(const PROC * a, const PROC * b)
 {
-    const CHILD *walk_a, *walk_b;
+    int i;
 
-    if (strcmp(a->comm, b->comm))
+    if (strcmp(proc_name(a), proc_name(b)))
         return 0;
     if (user_change && a->uid != b->uid)
         return 0;
-    for (walk_a = a->children, walk_b = b->children; walk_a && walk_b;
-         walk_a = walk_a->next, walk_b = walk_b->next)
-        if (!tree_equal(walk_a->child, walk_b->child))
+    if (a->nchildren != b->nchildren)
+        return 0;
+    for (i = 0; i < a->nchildren; i++)
+        if (!tree_equal(a->children[i], b->children[i]))
             return 0;
-    return !(walk_a || walk_b);
+    return 1;
+}
+
+/*
+ * Computes the structural hash of every subtree below current, bottom-up.
+ * It covers exactly what tree_equal compares, so equal subtrees always
+ * hash alike and tree_equal is only needed to rule out collisions.
+ */
+static unsigned int hash_tree(PROC * current)
+{
+    const unsigned char *here;
+    unsigned int hash = 2166136261U;
+    int i;
+
+    for (here = (const unsigned char *) proc_name(current); *here; here++)
+        hash = (hash ^ *here) * 16777619U;
+    if (user_change)
+        hash = (hash ^ (unsigned int) current->uid) * 16777619U;
+    for (i = 0; i < current->nchildren; i++)
+        hash = (hash ^ hash_tree(current->children[i])) * 16777619U;
+    return current->hash = hash;
+}
+
+/*
+ * Folds each run of siblings equal to an earlier one into that first
+ * sibling, whose count is set to the number folded.  Siblings are grouped
+ * through a hash table, so this is linear in the number of children.
+ * With threads_only set, only threads absorb their equals.
+ */
+static void compact_children(PROC * current, int threads_only)
+{
+    PROC **children = current->children, *this, **slot;
+    int i, keep, size;
+
+    for (size = 16; size < 2 * current->nchildren; size *= 2) ;
+    if (size > group_capacity) {
+        group_capacity = size;
+        free(group_table);
+        if (!(group_table = malloc(group_capacity * sizeof(PROC *)))) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    memset(group_table, 0, size * sizeof(PROC *));
+    for (i = keep = 0; i < current->nchildren; i++) {
+        this = children[i];
+        this->count = 0;
+        for (slot = &group_table[this->hash & (size - 1)]; *slot;
+             slot = &group_table[(slot - group_table + 1) & (size - 1)])
+            if ((*slot)->hash == this->hash && tree_equal(*slot, this))
+                break;
+        if (*slot)
+            (*slot)->count++;
+        else {
+            if (!threads_only || (this->flags & PFLAG_THREAD))
+                *slot = this;
+            children[keep++] = this;
+        }
+    }
+    current->nchildren = keep;
 }
 
 static int
-out_args(char *mystr)
+out_args(const char *mystr)
 {
-  char *here;
+  const char *here, *run;
   int strcount=0;
   char tmpstr[5];
 
@@ -399,8 +907,10 @@ out_args(char *mystr)
       out_string("\\\\");
       strcount += 2;
     } else if (*here >= ' ' && *here <= '~') {
-      out_char(*here);
-      strcount++;
+      for (run = here; run[1] >= ' ' && run[1] <= '~' && run[1] != '\\'; run++) ;
+      out_chars(here, run - here + 1);
+      strcount += run - here + 1;
+      here = run;
     } else {
       sprintf(tmpstr, "\\%03o", (unsigned char) *here);
       out_string(tmpstr);
@@ -410,28 +920,41 @@ out_args(char *mystr)
   return strcount;
 }
 
+
+/*
+ * Writes the figures of -R, e.g. rss=12M,cpu=1:05,thr=3 for 12 MiB
+ * resident, 1 minute 5 seconds of CPU time and 3 threads.
+ */
+static void out_rollup(const struct rollup *rollup)
+{
+    char buf[80];
+    unsigned long kb = rollup->rss * (page_size / 1024);
+    unsigned long long secs = rollup->cpu / clk_tck;
+
+    if (kb < 10240)
+        sprintf(buf, "rss=%luK", kb);
+    else if (kb < 10240 * 1024)
+        sprintf(buf, "rss=%luM", kb / 1024);
+    else
+        sprintf(buf, "rss=%luG", kb / (1024 * 1024));
+    out_string(buf);
+    sprintf(buf, ",cpu=%llu:%02llu,thr=%ld", secs / 60, secs % 60,
+            rollup->threads);
+    out_string(buf);
+}
+
 static void
 dump_tree(PROC * current, int level, int rep, int leaf, int last,
           uid_t prev_uid, int closing)
 {
-    CHILD *walk, *next, **scan;
-    const struct passwd *pw;
-    int lvl, i, add, offset, len, swapped, info, count, comm_len, first;
-    const char *tmp, *here;
+    int i, add, offset, swapped, info, count, comm_len;
+    const char *tmp;
 
     assert(closing >= 0);
     if (!current)
         return;
-    if (!leaf)
-        for (lvl = 0; lvl < level; lvl++) {
-            for (i = width[lvl] + 1; i; i--)
-                out_char(' ');
-            out_string(lvl ==
-                       level -
-                       1 ? last ? sym->last_2 : sym->branch_2 : more[lvl +
-                                                                     1] ?
-                       sym->vert_2 : sym->empty_2);
-        }
+    if (!leaf && level)
+        out_prefix(level, last);
     if (rep < 2)
         add = 0;
     else {
@@ -439,20 +962,29 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
         out_string("*[");
     }
     if ((current->flags & PFLAG_HILIGHT) && (tmp = tgetstr("md", NULL)))
-        tputs(tmp, 1, putchar);
+        tputs(tmp, 1, out_tputs);
     swapped = info = print_args;
     if (swapped && current->argc < 0)
         out_char('(');
-    comm_len = out_args(current->comm);
+    comm_len = out_args(proc_name(current));
     offset = cur_x;
-    if (pids) {
+    if (pids && !(current->flags & PFLAG_CGROUP)) {
+        out_char(info++ ? ',' : '(');
+        (void) out_int(current->ns_pid ? current->ns_pid : current->pid);
+    }
+    if (show_ns_pids && current->ns && current->ns != own_pid_ns
+        && (!current->parent || current->parent->ns != current->ns)) {
+        char buf[32];
+
+        sprintf(buf, "pidns=%lu", (unsigned long) current->ns->ino);
         out_char(info++ ? ',' : '(');
-        (void) out_int(current->pid);
+        out_string(buf);
     }
-    if (user_change && prev_uid != current->uid) {
+    if (user_change && prev_uid != current->uid
+        && !(current->flags & PFLAG_CGROUP)) {
         out_char(info++ ? ',' : '(');
-        if ((pw = getpwuid(current->uid)))
-            out_string(pw->pw_name);
+        if (!numeric_uids && (tmp = get_username(current->uid)))
+            out_string(tmp);
         else
             (void) out_int(current->uid);
     }
@@ -462,18 +994,19 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
         out_scontext(current->scontext);
     }
 #endif                                /*WITH_SELINUX */
+    if (show_rollups && !(current->flags & PFLAG_THREAD)) {
+        out_char(info++ ? ',' : '(');
+        out_rollup(&current->total);
+    }
     if ((swapped && print_args && current->argc < 0) || (!swapped && info))
         out_char(')');
     if ((current->flags & PFLAG_HILIGHT) && (tmp = tgetstr("me", NULL)))
-        tputs(tmp, 1, putchar);
+        tputs(tmp, 1, out_tputs);
     if (print_args) {
         for (i = 0; i < current->argc; i++) {
             if (i < current->argc - 1)        /* Space between words but not at the end of last */
                 out_char(' ');
-            len = 0;
-            for (here = current->argv[i]; *here; here++)
-                len += *here >= ' ' && *here <= '~' ? 1 : 4;
-            if (cur_x + len <=
+            if (cur_x + current->argw[i] <=
                 output_width - (i == current->argc - 1 ? 0 : 4) || !trunc)
               out_args(current->argv[i]);
             else {
@@ -483,9 +1016,9 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
         }
     }
 #ifdef WITH_SELINUX
-    if (show_scontext || print_args || !current->children)
+    if (show_scontext || print_args || !current->nchildren)
 #else                                /*WITH_SELINUX */
-    if (print_args || !current->children)
+    if (print_args || !current->nchildren)
 #endif                                /*WITH_SELINUX */
     {
         while (closing--)
@@ -494,6 +1027,8 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
     }
     ensure_buffer_capacity(level);
     more[level] = !last;
+    if (level)
+        cache_prefix(level - 1);
 
 #ifdef WITH_SELINUX
     if (show_scontext || print_args)
@@ -502,29 +1037,17 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
 #endif                                /*WITH_SELINUX */
     {
         width[level] = swapped + (comm_len > 1 ? 0 : -1);
-        count=0;
-        first=1;
-        for (walk = current->children; walk; walk = next) {
-          next = walk->next;
-          count=0;
-          if (compact && (walk->child->flags & PFLAG_THREAD)) {
-            scan = &walk->next;
-            while (*scan) {
-              if (!tree_equal(walk->child, (*scan)->child)) {
-                scan = &(*scan)->next;
-              } else {
-                if (next == *scan)
-                  next = (*scan)->next;
-                count++;
-                *scan = (*scan)->next;
-              }
-            }
-            dump_tree(walk->child, level + 1, count + 1,
-                  0, !next, current->uid, closing+ (count ? 2 : 1));
-                 //closing + (count ? 1 : 0));
+        if (compact)
+          compact_children(current, 1);
+        for (i = 0; i < current->nchildren; i++) {
+          if (compact && (current->children[i]->flags & PFLAG_THREAD)) {
+            count = current->children[i]->count;
+            dump_tree(current->children[i], level + 1, count + 1,
+                  0, i == current->nchildren - 1, current->uid,
+                  closing + (count ? 2 : 1));
           } else {
-          dump_tree(walk->child, level + 1, 1, 0, !walk->next,
-                      current->uid, 0);
+          dump_tree(current->children[i], level + 1, 1, 0,
+                      i == current->nchildren - 1, current->uid, 0);
           }
         }
         return;
@@ -536,49 +1059,178 @@ dump_tree(PROC * current, int level, int rep, int leaf, int last,
         out_newline();
         return;
     }
-    first = 1;
-    for (walk = current->children; walk; walk = next) {
-        count = 0;
-        next = walk->next;
-        if (compact) {
-            scan = &walk->next;
-            while (*scan)
-                if (!tree_equal(walk->child, (*scan)->child))
-                    scan = &(*scan)->next;
-                else {
-                    if (next == *scan)
-                        next = (*scan)->next;
-                    count++;
-                    *scan = (*scan)->next;
-                }
-        }
-        if (first) {
-            out_string(next ? sym->first_3 : sym->single_3);
-            first = 0;
-        }
-        dump_tree(walk->child, level + 1, count + 1,
-                  walk == current->children, !next, current->uid,
+    if (compact)
+        compact_children(current, 0);
+    for (i = 0; i < current->nchildren; i++) {
+        count = compact ? current->children[i]->count : 0;
+        if (!i)
+            out_string(current->nchildren > 1 ? sym->first_3 : sym->single_3);
+        dump_tree(current->children[i], level + 1, count + 1,
+                  !i, i == current->nchildren - 1, current->uid,
                   closing + (count ? 1 : 0));
     }
 }
 
 
+static void put_json_string(const char *str)
+{
+    putchar('"');
+    for (; *str; str++)
+        if (*str == '"' || *str == '\\') {
+            putchar('\\');
+            putchar(*str);
+        } else if ((unsigned char) *str < ' ')
+            printf("\\u%04x", *str);
+        else
+            putchar(*str);
+    putchar('"');
+}
+
+static void put_tsv_string(const char *str)
+{
+    for (; *str; str++)
+        if (*str == '\t')
+            fputs("\\t", stdout);
+        else if (*str == '\n')
+            fputs("\\n", stdout);
+        else if (*str == '\\')
+            fputs("\\\\", stdout);
+        else
+            putchar(*str);
+}
+
+/*
+ * Writes current and everything below it as records of output_format,
+ * depth first and straight to stdout.  count is the number of identical
+ * processes current stands for after compaction.
+ */
+static void dump_record(PROC * current, int depth, int count)
+{
+    int i, argc;
+
+    /* the NUL read_pid adds after cmdline's own shows up as an empty
+       last argument */
+    argc = current->argc;
+    if (argc > 0 && !*current->argv[argc - 1])
+        argc--;
+    if (compact)
+        compact_children(current, print_args);
+    if (output_format == FORMAT_TSV) {
+        printf("%d\t%d\t%d\t", current->pid,
+               current->parent ? current->parent->pid : 0, depth);
+        put_tsv_string(proc_name(current));
+        printf("\t%u\t%d\t%d\t", (unsigned) current->uid,
+               (current->flags & PFLAG_THREAD) ? 1 : 0, count);
+        if (show_rollups)
+            printf("%lu\t%llu\t%ld\t",
+                   current->total.rss * (page_size / 1024),
+                   current->total.cpu * 1000 / clk_tck,
+                   current->total.threads);
+        if (show_ns_pids)
+            printf("%d\t%lu\t", current->ns_pid,
+                   current->ns ? (unsigned long) current->ns->ino : 0);
+        for (i = 0; i < argc; i++) {
+            if (i)
+                putchar(' ');
+            put_tsv_string(current->argv[i]);
+        }
+        putchar('\n');
+    } else {
+        printf("{\"pid\":%d,\"ppid\":%d,", current->pid,
+               current->parent ? current->parent->pid : 0);
+        if (output_format == FORMAT_NDJSON)
+            printf("\"depth\":%d,", depth);
+        fputs("\"comm\":", stdout);
+        put_json_string(proc_name(current));
+        printf(",\"uid\":%u,\"thread\":%s,\"count\":%d",
+               (unsigned) current->uid,
+               (current->flags & PFLAG_THREAD) ? "true" : "false", count);
+        if (show_rollups)
+            printf(",\"rss_kb\":%lu,\"cpu_ms\":%llu,\"threads\":%ld",
+                   current->total.rss * (page_size / 1024),
+                   current->total.cpu * 1000 / clk_tck,
+                   current->total.threads);
+        if (show_ns_pids)
+            printf(",\"ns_pid\":%d,\"pidns\":%lu", current->ns_pid,
+                   current->ns ? (unsigned long) current->ns->ino : 0);
+        if (print_args) {
+            fputs(",\"args\":", stdout);
+            if (argc < 0)               /* swapped out */
+                fputs("null", stdout);
+            else {
+                putchar('[');
+                for (i = 0; i < argc; i++) {
+                    if (i)
+                        putchar(',');
+                    put_json_string(current->argv[i]);
+                }
+                putchar(']');
+            }
+        }
+        if (output_format == FORMAT_NDJSON)
+            fputs("}\n", stdout);
+        else
+            fputs(",\"children\":[", stdout);
+    }
+    for (i = 0; i < current->nchildren; i++) {
+        if (i && output_format == FORMAT_JSON)
+            putchar(',');
+        dump_record(current->children[i], depth + 1,
+                    compact ? current->children[i]->count + 1 : 1);
+    }
+    if (output_format == FORMAT_JSON)
+        fputs("]}", stdout);
+}
+
 static void dump_by_user(PROC * current, uid_t uid)
 {
-    const CHILD *walk;
+    int i;
 
     if (!current)
         return;
 
     if (current->uid == uid) {
-        if (dumped)
-            putchar('\n');
-        dump_tree(current, 0, 1, 1, 1, uid, 0);
+        if (output_format == FORMAT_TEXT) {
+            if (dumped)
+                putchar('\n');
+            dump_tree(current, 0, 1, 1, 1, uid, 0);
+        } else {
+            if (dumped && output_format == FORMAT_JSON)
+                putchar(',');
+            dump_record(current, 0, 1);
+        }
         dumped = 1;
         return;
     }
-    for (walk = current->children; walk; walk = walk->next)
-        dump_by_user(walk->child, uid);
+    for (i = 0; i < current->nchildren; i++)
+        dump_by_user(current->children[i], uid);
+}
+
+/*
+ * Shows the tree starting at current, or with pw all the trees of that
+ * user below it.
+ */
+static void show_tree(PROC * current, const struct passwd *pw)
+{
+    dumped = 0;
+    if (output_format == FORMAT_JSON)
+        putchar('[');
+    else if (output_format == FORMAT_TSV) {
+        fputs("pid\tppid\tdepth\tcomm\tuid\tthread\tcount\t", stdout);
+        if (show_rollups)
+            fputs("rss_kb\tcpu_ms\tthreads\t", stdout);
+        if (show_ns_pids)
+            fputs("ns_pid\tpidns\t", stdout);
+        fputs("args\n", stdout);
+    }
+    if (pw)
+        dump_by_user(current, pw->pw_uid);
+    else if (output_format == FORMAT_TEXT)
+        dump_tree(current, 0, 1, 1, 1, 0, 0);
+    else if (current)
+        dump_record(current, 0, 1);
+    if (output_format == FORMAT_JSON)
+        fputs("]\n", stdout);
 }
 
 static void trim_tree_by_parent(PROC * current)
@@ -591,220 +1243,1271 @@ static void trim_tree_by_parent(PROC * current)
   if (!parent)
     return;
 
-  parent->children = NULL;
-  add_child(parent, current);
+  parent->children[0] = current;
+  parent->nchildren = 1;
   trim_tree_by_parent(parent);
 }
 
 
 /*
- * read_proc now uses a similar method as procps for finding the process
- * name in the /proc filesystem. My thanks to Albert and procps authors.
+ * Opens name inside the /proc/PID directory pid_dir, relative to the
+ * already open /proc directory descriptor.
  */
-static void read_proc(void)
+static int open_pid_file(int proc_fd, const char *pid_dir, const char *name,
+                         int flags)
 {
-  DIR *dir;
-  struct dirent *de;
-  FILE *file;
-  struct stat st;
-  char *path, *comm;
-  char *buffer;
-  size_t buffer_size;
-  char readbuf[BUFSIZ + 1];
-  char *tmpptr;
-  pid_t pid, ppid;
-  int fd, size;
-  int empty;
-#ifdef WITH_SELINUX
-  security_context_t scontext = NULL;
-  int selinux_enabled = is_selinux_enabled() > 0;
-#endif                /*WITH_SELINUX */
+  char path[64];
+  size_t dir_len = strlen(pid_dir), name_len = strlen(name);
 
-  if (trunc)
-    buffer_size = output_width + 1;
-  else
-    buffer_size = BUFSIZ + 1;
+  if (dir_len + name_len + 2 > sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memcpy(path, pid_dir, dir_len);
+  path[dir_len] = '/';
+  memcpy(path + dir_len + 1, name, name_len + 1);
+  return openat(proc_fd, path, flags);
+}
 
-  if (!print_args)
-    buffer = NULL;
-  else if (!(buffer = malloc(buffer_size))) {
+static struct pid_ns *find_pid_ns(ino_t ino)
+{
+  struct pid_ns *ns;
+
+  for (ns = pid_namespaces; ns; ns = ns->next)
+    if (ns->ino == ino)
+      return ns;
+  if (!(ns = malloc(sizeof(struct pid_ns)))) {
     perror("malloc");
     exit(1);
   }
-  if (!(dir = opendir(PROC_BASE))) {
-    perror(PROC_BASE);
-    exit(1);
-  }
-  empty = 1;
-  while ((de = readdir(dir)) != NULL)
-    if ((pid = (pid_t) atoi(de->d_name)) != 0) {
-      if (! (path = malloc(strlen(PROC_BASE) + strlen(de->d_name) + 10)))
-        exit(2);
-      sprintf(path, "%s/%d/stat", PROC_BASE, pid);
-      if ((file = fopen(path, "r")) != NULL) {
-        empty = 0;
-        sprintf(path, "%s/%d", PROC_BASE, pid);
+  ns->ino = ino;
+  ns->next = pid_namespaces;
+  pid_namespaces = ns;
+  return ns;
+}
+
+/*
+ * Returns the pid of the process as seen in its own PID namespace, which
+ * is the last field of the NSpid line in its status, and stores the inode
+ * of that namespace in *ns_ino. Processes in our own namespace need no
+ * status read.
+ */
+static pid_t read_ns_pid(int proc_fd, const char *pid_dir, pid_t pid,
+                         ino_t *ns_ino)
+{
+  char path[64], line[BUFSIZ], *field;
+  struct stat st;
+  pid_t ns_pid = pid;
+  FILE *file;
+  int fd;
+
+  *ns_ino = 0;
+  snprintf(path, sizeof(path), "%s/ns/pid", pid_dir);
+  if (fstatat(proc_fd, path, &st, 0) < 0)
+    return pid;                 /* no namespaces, or not ours to look at */
+  *ns_ino = st.st_ino;
+  if (own_pid_ns && st.st_ino == own_pid_ns->ino)
+    return pid;
+  if ((fd = open_pid_file(proc_fd, pid_dir, "status", O_RDONLY)) < 0)
+    return pid;
+  if (!(file = fdopen(fd, "r"))) {
+    (void) close(fd);
+    return pid;
+  }
+  while (fgets(line, sizeof(line), file))
+    if (!strncmp(line, "NSpid:", 6)) {
+      if ((field = strrchr(line, '\t')) != NULL && atoi(field + 1) > 0)
+        ns_pid = atoi(field + 1);
+      break;
+    }
+  (void) fclose(file);
+  return ns_pid;
+}
+
+struct pid_list {
+  pid_t *pids;
+  int len;
+  int size;
+};
+
+static void push_pid(struct pid_list *list, pid_t pid)
+{
+  if (list->len == list->size) {
+    list->size = list->size ? list->size * 2 : 64;
+    if (!(list->pids = realloc(list->pids, list->size * sizeof(pid_t)))) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  list->pids[list->len++] = pid;
+}
+
+/*
+ * Buffers fetch_pid keeps the command lines and thread ids in until
+ * store_pid adds them to the tree. Each thread reading /proc has its own.
+ */
+struct reader {
+  char *text;
+  size_t text_len;
+  size_t text_size;
+  struct pid_list tids;
+};
+
+/* What fetch_pid found out about a process, see store_pid */
+struct pid_info {
+  pid_t pid;
+  pid_t ppid;                   /* -1 if it could not be read */
+  uid_t uid;
+  char comm[COMM_LEN + 1];
+  long num_threads;
+  struct rollup own;
+  ino_t ns_ino;                 /* with -P, its pid namespace if known */
+  pid_t ns_pid;
+  size_t args;                  /* offset of the command line in text */
+  int args_size;                /* -1 without -a */
+  int tids;                     /* index of the first thread id in tids */
+  int ntids;
+  const struct reader *reader;
 #ifdef WITH_SELINUX
-        if (selinux_enabled)
-          if (getpidcon(pid, &scontext) < 0) {
-            perror(path);
-            exit(1);
-          }
+  security_context_t scontext;
 #endif                /*WITH_SELINUX */
-        if (stat(path, &st) < 0) {
-          perror(path);
-          exit(1);
-        }
-        size = fread(readbuf, 1, BUFSIZ, file);
-        if (ferror(file) == 0) {
-          readbuf[size] = 0;
-          /* commands may have spaces or ) in them.
-           * so don't trust anything from the ( to the last ) */
-          if ((comm = strchr(readbuf, '('))
-            && (tmpptr = strrchr(comm, ')'))) {
-            ++comm;
-            *tmpptr = 0;
-            /* We now have readbuf with pid and cmd, and tmpptr+2
-             * with the rest */
-            /*printf("tmpptr: %s\n", tmpptr+2); */
-            if (sscanf(tmpptr + 2, "%*c %d", &ppid) == 1) {
-              DIR *taskdir;
-              struct dirent *dt;
-              char *taskpath;
-              char *threadname;
-              int thread;
-
-              if (! (taskpath = malloc(strlen(path) + 10)))
-                exit(2);
-              sprintf(taskpath, "%s/task", path);
-
-              if ((taskdir = opendir(taskpath)) != 0) {
-                /* if we have this dir, we're on 2.6 */
-                if (! (threadname = malloc(COMM_LEN + 2 + 1))) {
-                    exit(2);
-                }
-                sprintf(threadname, "{%.*s}", COMM_LEN, comm);
-                while ((dt = readdir(taskdir)) != NULL) {
-                  if ((thread = atoi(dt->d_name)) != 0) {
-                    if (thread != pid) {
+};
+
+static struct reader serial_reader;
+
+static void free_reader(struct reader *reader)
+{
+  free(reader->text);
+  free(reader->tids.pids);
+  memset(reader, 0, sizeof(struct reader));
+}
+
+/*
+ * read_proc now uses a similar method as procps for finding the process
+ * name in the /proc filesystem. My thanks to Albert and procps authors.
+ * Everything is opened relative to one /proc descriptor and read into
+ * buffers that are reused for every process.
+ */
+static char *cmd_buffer = NULL;
+static size_t cmd_buffer_size;
 #ifdef WITH_SELINUX
-                      if (print_args)
-                        add_proc(threadname, thread, pid, st.st_uid, 
-                            threadname, strlen (threadname) + 1, 1,scontext);
-                      else
-                        add_proc(threadname, thread, pid, st.st_uid, 
-                            NULL, 0, 1, scontext);
-#else                /*WITH_SELINUX */
-                      if (print_args)
-                        add_proc(threadname, thread, pid, st.st_uid,
-                            threadname, strlen (threadname) + 1, 1);
-                      else
-                        add_proc(threadname, thread, pid, st.st_uid,
-                            NULL, 0, 1);
+static int selinux_enabled;
 #endif                /*WITH_SELINUX */
-                      }
-                    }
-                  }
-                  free(threadname);
-                  (void) closedir(taskdir);
-                }
-              free(taskpath);
-              if (!print_args)
+
+static void start_read(void)
+{
+  if (trunc)
+    cmd_buffer_size = output_width + 1;
+  else
+    cmd_buffer_size = BUFSIZ + 1;
+
+  if (print_args && !(cmd_buffer = malloc(cmd_buffer_size))) {
+    perror("malloc");
+    exit(1);
+  }
 #ifdef WITH_SELINUX
-                add_proc(comm, pid, ppid, st.st_uid, NULL, 0, 0, scontext);
+  selinux_enabled = is_selinux_enabled() > 0;
+#endif                /*WITH_SELINUX */
+}
+
+static void end_read(void)
+{
+  free(cmd_buffer);
+  cmd_buffer = NULL;
+  free_reader(&serial_reader);
+}
+
+/*
+ * Parses the stat fields after the ") " that ends the command name: the
+ * parent pid, the thread count (field 20) and the figures of -R.  Returns
+ * -1 if not even the parent pid is there.
+ */
+static int parse_stat(const char *fields, pid_t * ppid, long *num_threads,
+                      struct rollup *own)
+{
+  unsigned long utime = 0, stime = 0;
+  long rss = 0;
+
+  *num_threads = 0;
+  if (sscanf(fields, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+             "%lu %lu %*d %*d %*d %*d %ld %*d %*u %*u %ld", ppid,
+             &utime, &stime, num_threads, &rss) < 1)
+    return -1;
+  own->rss = rss;
+  own->cpu = (unsigned long long) utime + stime;
+  own->threads = *num_threads;
+  return 0;
+}
+
+/*
+ * Reads the process pid (whose directory below /proc is pid_dir) and its
+ * threads, unless with_threads is 0, into info and reader. Sets info->ppid
+ * to -1 if the process could not be read. Only touches info and reader,
+ * so several threads may run it at once.
+ */
+static void fetch_pid(struct reader *reader, int proc_fd, const char *pid_dir,
+                      pid_t pid, int with_threads, struct pid_info *info)
+{
+  struct stat st;
+  char *comm;
+  char readbuf[BUFSIZ + 1];
+  char *tmpptr;
+  int fd, size;
+
+  info->pid = pid;
+  info->ppid = -1;
+  info->num_threads = 0;
+  info->reader = reader;
+  info->ns_ino = 0;
+  info->ns_pid = 0;
+  info->args_size = -1;
+  info->tids = reader->tids.len;
+  info->ntids = 0;
+#ifdef WITH_SELINUX
+  info->scontext = NULL;
+#endif                /*WITH_SELINUX */
+  if ((fd = open_pid_file(proc_fd, pid_dir, "stat", O_RDONLY)) < 0)
+    return;
+#ifdef WITH_SELINUX
+  if (selinux_enabled)
+    if (getpidcon(pid, &info->scontext) < 0) {
+      fprintf(stderr, "%s/%d: %s\n", PROC_BASE, pid, strerror(errno));
+      exit(1);
+    }
+#endif                /*WITH_SELINUX */
+  if (fstatat(proc_fd, pid_dir, &st, 0) < 0) {
+    if (errno == ENOENT) {      /* exited meanwhile */
+      (void) close(fd);
+      return;
+    }
+    fprintf(stderr, "%s/%d: %s\n", PROC_BASE, pid, strerror(errno));
+    exit(1);
+  }
+  info->uid = st.st_uid;
+  size = pread(fd, readbuf, BUFSIZ, 0);
+  (void) close(fd);
+  if (size < 0)
+    return;
+  readbuf[size] = 0;
+  /* commands may have spaces or ) in them.
+   * so don't trust anything from the ( to the last ) */
+  if (!(comm = strchr(readbuf, '('))
+      || !(tmpptr = strrchr(comm, ')')))
+    return;
+  ++comm;
+  *tmpptr = 0;
+  snprintf(info->comm, sizeof(info->comm), "%s", comm);
+  /* We now have readbuf with pid and cmd, and tmpptr+2
+   * with the rest */
+  if (parse_stat(tmpptr + 2, &info->ppid, &info->num_threads,
+                 &info->own) < 0) {
+    info->ppid = -1;
+    return;
+  }
+  if (show_ns_pids)
+    info->ns_pid = read_ns_pid(proc_fd, pid_dir, pid, &info->ns_ino);
+  /* Only walk the task directory if there are other threads to find,
+   * or if the kernel didn't tell us */
+  if (with_threads && !hide_threads && info->num_threads != 1
+      && (fd = open_pid_file(proc_fd, pid_dir, "task",
+                             O_RDONLY | O_DIRECTORY)) >= 0) {
+    DIR *taskdir;
+    struct dirent *dt;
+    int thread;
+
+    /* if we have this dir, we're on 2.6 */
+    if ((taskdir = fdopendir(fd)) == NULL)
+      (void) close(fd);
+    else {
+      while ((dt = readdir(taskdir)) != NULL)
+        if ((thread = atoi(dt->d_name)) != 0 && thread != pid)
+          push_pid(&reader->tids, thread);
+      (void) closedir(taskdir);
+      info->ntids = reader->tids.len - info->tids;
+    }
+  }
+  if (!print_args)
+    return;
+  if (reader->text_len + cmd_buffer_size > reader->text_size) {
+    reader->text_size = reader->text_size ? reader->text_size * 2 : BUFSIZ;
+    if (reader->text_size < reader->text_len + cmd_buffer_size)
+      reader->text_size = reader->text_len + cmd_buffer_size;
+    if (!(reader->text = realloc(reader->text, reader->text_size))) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  if ((fd = open_pid_file(proc_fd, pid_dir, "cmdline", O_RDONLY)) < 0
+      || (size = pread(fd, reader->text + reader->text_len,
+                       cmd_buffer_size, 0)) < 0) {
+    if (errno == ENOENT || errno == ESRCH) {  /* exited meanwhile */
+      if (fd >= 0)
+        (void) close(fd);
+      info->ppid = -1;
+      return;
+    }
+    fprintf(stderr, "%s/%d/cmdline: %s\n", PROC_BASE, pid,
+            strerror(errno));
+    exit(1);
+  }
+  (void) close(fd);
+  /* If we have read the maximum screen length of args, bring it back by one to stop overflow */
+  if (size >= cmd_buffer_size)
+    size--;
+  if (size)
+    reader->text[reader->text_len + size++] = 0;
+  info->args = reader->text_len;
+  info->args_size = size;
+  reader->text_len += size;
+}
+
+/*
+ * Adds a process fetched by fetch_pid and its threads to the tree.
+ */
+static void store_pid(const struct pid_info *info)
+{
+  char threadname[COMM_LEN + 2 + 1];
+  struct pid_ns *ns = NULL;
+  const pid_t *tid;
+  PROC *this;
+  int i;
+
+  if (info->ns_ino)
+    ns = find_pid_ns(info->ns_ino);
+  sprintf(threadname, "{%.*s}", COMM_LEN, info->comm);
+  for (i = 0, tid = info->reader->tids.pids + info->tids; i < info->ntids;
+       i++, tid++) {
+#ifdef WITH_SELINUX
+    if (print_args)
+      this = add_proc(threadname, *tid, info->pid, info->uid,
+          threadname, strlen (threadname) + 1, 1, info->scontext);
+    else
+      this = add_proc(threadname, *tid, info->pid, info->uid,
+          NULL, 0, 1, info->scontext);
 #else                /*WITH_SELINUX */
-                add_proc(comm, pid, ppid, st.st_uid, NULL, 0, 0);
+    if (print_args)
+      this = add_proc(threadname, *tid, info->pid, info->uid,
+          threadname, strlen (threadname) + 1, 1);
+    else
+      this = add_proc(threadname, *tid, info->pid, info->uid,
+          NULL, 0, 1);
 #endif                /*WITH_SELINUX */
-              else {
-                sprintf(path, "%s/%d/cmdline", PROC_BASE, pid);
-                if ((fd = open(path, O_RDONLY)) < 0) {
-                  perror(path);
-                  exit(1);
-                }
-                if ((size = read(fd, buffer, buffer_size)) < 0) {
-                  perror(path);
-                  exit(1);
-                }
-                (void) close(fd);
-                /* If we have read the maximum screen length of args, bring it back by one to stop overflow */
-                if (size >= buffer_size)
-                  size--;
-                if (size)
-                  buffer[size++] = 0;
+    /* translating thread ids would cost a status read each */
+    this->ns = ns;
+    if (ns == own_pid_ns)
+      this->ns_pid = *tid;
+  }
 #ifdef WITH_SELINUX
-                add_proc(comm, pid, ppid, st.st_uid,
-                     buffer, size, 0, scontext);
+  this = add_proc(info->comm, info->pid, info->ppid, info->uid,
+       info->args_size < 0 ? NULL : info->reader->text + info->args,
+       info->args_size, 0, info->scontext);
 #else                /*WITH_SELINUX */
-                add_proc(comm, pid, ppid, st.st_uid,
-                     buffer, size, 0);
+  this = add_proc(info->comm, info->pid, info->ppid, info->uid,
+       info->args_size < 0 ? NULL : info->reader->text + info->args,
+       info->args_size, 0);
 #endif                /*WITH_SELINUX */
-              }
-            }
-          }
-        }
-        (void) fclose(file);
-      }
-      free(path);
+  this->own = info->own;
+  this->ns = ns;
+  this->ns_pid = info->ns_pid;
+}
+
+/*
+ * Reads the process pid (whose directory below /proc is pid_dir) and its
+ * threads, unless with_threads is 0. Returns the parent pid, or -1 if the
+ * process could not be read. The thread count from stat is stored in
+ * num_threads.
+ */
+static pid_t read_pid(int proc_fd, const char *pid_dir, pid_t pid,
+                      int with_threads, long *num_threads)
+{
+  struct pid_info info;
+
+  fetch_pid(&serial_reader, proc_fd, pid_dir, pid, with_threads, &info);
+  *num_threads = info.num_threads;
+  if (info.ppid >= 0)
+    store_pid(&info);
+  serial_reader.text_len = 0;
+  serial_reader.tids.len = 0;
+  return info.ppid;
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * On hosts with many processes /proc is read by several threads, each
+ * fetching every readers'th process into its own buffers. The tree is
+ * then built from their results in /proc order by this thread alone, so
+ * the output is the same as when reading one process after another.
+ */
+#define READERS_MAX     8
+#define PIDS_PER_READER 256       /* fewer are not worth a thread */
+
+struct read_job {
+  pthread_t thread;
+  int started;
+  struct reader reader;
+  int proc_fd;
+  struct pid_info *infos;
+  int first;
+  int count;
+  int stride;
+  pid_t self;                   /* already fetched */
+};
+
+static void *run_read_job(void *arg)
+{
+  struct read_job *job = arg;
+  char pid_dir[16];
+  int i;
+
+  for (i = job->first; i < job->count; i += job->stride) {
+    if (job->infos[i].pid == job->self)
+      continue;
+    sprintf(pid_dir, "%d", (int) job->infos[i].pid);
+    fetch_pid(&job->reader, job->proc_fd, pid_dir, job->infos[i].pid, 1,
+              &job->infos[i]);
+  }
+  return NULL;
+}
+
+/*
+ * Returns the number of threads to read pids with, 1 if it's not worth it.
+ */
+static int count_readers(const struct pid_list *pids)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int readers = pids->len / PIDS_PER_READER;
+
+  if (readers > cpus)
+    readers = cpus;
+  if (readers > READERS_MAX)
+    readers = READERS_MAX;
+  return readers > 1 ? readers : 1;
+}
+
+/*
+ * Reads the processes in pids with readers threads. Returns 0 if none of
+ * them could be read.
+ */
+static int read_pids_parallel(int proc_fd, const struct pid_list *pids,
+                              int readers)
+{
+  struct pid_info *infos;
+  struct read_job *jobs;
+  char pid_dir[16];
+  pid_t self = getpid();
+  int i, found = 0;
+
+  if (!(infos = malloc(pids->len * sizeof(struct pid_info)))
+      || !(jobs = calloc(readers, sizeof(struct read_job)))) {
+    perror("malloc");
+    exit(1);
+  }
+  /* we are read before the readers start, so they don't show up */
+  sprintf(pid_dir, "%d", (int) self);
+  for (i = 0; i < pids->len; i++)
+    if ((infos[i].pid = pids->pids[i]) == self)
+      fetch_pid(&jobs[0].reader, proc_fd, pid_dir, self, 1, &infos[i]);
+  for (i = 0; i < readers; i++) {
+    jobs[i].self = self;
+    jobs[i].proc_fd = proc_fd;
+    jobs[i].infos = infos;
+    jobs[i].first = i;
+    jobs[i].count = pids->len;
+    jobs[i].stride = readers;
+    /* without a thread, the job is done below by this one */
+    jobs[i].started = i
+        && pthread_create(&jobs[i].thread, NULL, run_read_job, &jobs[i]) == 0;
+  }
+  for (i = 0; i < readers; i++)
+    if (!jobs[i].started)
+      (void) run_read_job(&jobs[i]);
+  for (i = 0; i < readers; i++)
+    if (jobs[i].started)
+      (void) pthread_join(jobs[i].thread, NULL);
+  for (i = 0; i < pids->len; i++)
+    if (infos[i].ppid >= 0) {
+      store_pid(&infos[i]);
+      found = 1;
+    }
+  for (i = 0; i < readers; i++)
+    free_reader(&jobs[i].reader);
+  free(jobs);
+  free(infos);
+  return found;
+}
+#endif                /*HAVE_PTHREAD_H */
+
+static void read_proc(void)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct pid_list pids = { NULL, 0, 0 };
+  char pid_dir[16];
+  pid_t pid;
+  long num_threads;
+  int i, empty;
+#ifdef HAVE_PTHREAD_H
+  int readers;
+#endif                /*HAVE_PTHREAD_H */
+
+  if (!(dir = opendir(PROC_BASE))) {
+    perror(PROC_BASE);
+    exit(1);
+  }
+  while ((de = readdir(dir)) != NULL)
+    if ((pid = (pid_t) atoi(de->d_name)) != 0)
+      push_pid(&pids, pid);
+  start_read();
+  empty = 1;
+#ifdef HAVE_PTHREAD_H
+  if ((readers = count_readers(&pids)) > 1)
+    empty = !read_pids_parallel(dirfd(dir), &pids, readers);
+  else
+#endif                /*HAVE_PTHREAD_H */
+    for (i = 0; i < pids.len; i++) {
+      sprintf(pid_dir, "%d", (int) pids.pids[i]);
+      if (read_pid(dirfd(dir), pid_dir, pids.pids[i], 1, &num_threads) >= 0)
+        empty = 0;
     }
   (void) closedir(dir);
-  if (print_args)
-    free(buffer);
+  end_read();
+  free(pids.pids);
   if (empty) {
     fprintf(stderr, _("%s is empty (not mounted ?)\n"), PROC_BASE);
     exit(1);
   }
 }
 
+static struct pid_list pid_stack;
+
+/*
+ * Pushes the children of thread tid of the process in pid_dir, as listed by
+ * its task/TID/children file.
+ */
+static void read_task_children(int proc_fd, const char *pid_dir,
+                               const char *tid)
+{
+  char name[32];
+  FILE *file;
+  int fd, child;
+
+  snprintf(name, sizeof(name), "task/%s/children", tid);
+  if ((fd = open_pid_file(proc_fd, pid_dir, name, O_RDONLY)) < 0)
+    return;
+  if (!(file = fdopen(fd, "r"))) {
+    (void) close(fd);
+    return;
+  }
+  while (fscanf(file, "%d", &child) == 1)
+    push_pid(&pid_stack, child);
+  (void) fclose(file);
+}
 
-#if 0
+/*
+ * Pushes the children of every thread of the process in pid_dir. Children
+ * are kept per thread, so all of them have to be asked unless there is
+ * only one.
+ */
+static void read_children(int proc_fd, const char *pid_dir, long num_threads)
+{
+  DIR *taskdir;
+  struct dirent *dt;
+  int fd;
 
-/* Could use output of  ps achlx | awk '{ print $3,$4,$2,$13 }'  */
+  if (num_threads == 1) {
+    read_task_children(proc_fd, pid_dir, pid_dir);
+    return;
+  }
+  if ((fd = open_pid_file(proc_fd, pid_dir, "task",
+                          O_RDONLY | O_DIRECTORY)) < 0)
+    return;
+  if ((taskdir = fdopendir(fd)) == NULL) {
+    (void) close(fd);
+    return;
+  }
+  while ((dt = readdir(taskdir)) != NULL)
+    if (isdigit(*dt->d_name))
+      read_task_children(proc_fd, pid_dir, dt->d_name);
+  (void) closedir(taskdir);
+}
 
-static void read_stdin(void)
+/*
+ * Returns the thread group id of pid, or -1 if it can't be found.
+ */
+static pid_t get_tgid(int proc_fd, const char *pid_dir)
 {
-    char comm[PATH_MAX + 1];
-    char *cmd;
-    int pid, ppid, uid;
+  char readbuf[BUFSIZ + 1];
+  char *tmpptr;
+  int fd, size;
+
+  if ((fd = open_pid_file(proc_fd, pid_dir, "status", O_RDONLY)) < 0)
+    return -1;
+  size = pread(fd, readbuf, BUFSIZ, 0);
+  (void) close(fd);
+  if (size < 0)
+    return -1;
+  readbuf[size] = 0;
+  if (!(tmpptr = strstr(readbuf, "\nTgid:")))
+    return -1;
+  return (pid_t) atoi(tmpptr + 6);
+}
+
+/*
+ * Reads the ancestors of pid that haven't been read yet, without their
+ * threads. Returns the pid at the top of the chain, or -1 if the chain is
+ * broken.
+ */
+static pid_t read_ancestors(int proc_fd, pid_t pid)
+{
+  char pid_dir[16];
+  long num_threads;
+  PROC *proc;
+  pid_t ppid;
+
+  for (ppid = pid; ppid > 0;) {
+    pid = ppid;
+    if ((proc = find_proc(pid)) && proc->parent)
+      ppid = proc->parent->pid;
+    else {
+      sprintf(pid_dir, "%d", (int) pid);
+      if ((ppid = read_pid(proc_fd, pid_dir, pid, 0, &num_threads)) < 0)
+        return -1;
+    }
+  }
+  return pid;
+}
+
+/*
+ * Reads only the subtree below pid, following the children lists the
+ * kernel keeps for every task, plus the ancestors of pid (with
+ * show_parents) and of highlight, following the ppid chain. This way the
+ * cost is proportional to what is shown rather than to the number of
+ * processes on the system.
+ * Returns 0 if the whole of /proc has to be read instead: the kernel
+ * doesn't keep children lists, pid is not a process, or its ancestors
+ * don't lead up to init.
+ */
+static int read_subtree(pid_t pid, pid_t highlight)
+{
+  char pid_dir[16], name[48];
+  long num_threads;
+  pid_t current;
+  int proc_fd, complete;
+
+  if ((proc_fd = open(PROC_BASE, O_RDONLY | O_DIRECTORY)) < 0) {
+    perror(PROC_BASE);
+    exit(1);
+  }
+  sprintf(pid_dir, "%d", (int) pid);
+  sprintf(name, "self/task/%d/children", (int) getpid());
+  if (faccessat(proc_fd, name, R_OK, 0) < 0
+      || get_tgid(proc_fd, pid_dir) != pid) {
+    (void) close(proc_fd);
+    return 0;
+  }
+  start_read();
+  push_pid(&pid_stack, pid);
+  while (pid_stack.len) {
+    current = pid_stack.pids[--pid_stack.len];
+    sprintf(pid_dir, "%d", (int) current);
+    if (read_pid(proc_fd, pid_dir, current, 1, &num_threads) >= 0)
+      read_children(proc_fd, pid_dir, num_threads);
+  }
+  free(pid_stack.pids);
+  pid_stack.pids = NULL;
+  pid_stack.size = 0;
+  complete = !show_parents || read_ancestors(proc_fd, pid) == 1;
+  if (complete && highlight)
+    (void) read_ancestors(proc_fd, highlight);
+  end_read();
+  (void) close(proc_fd);
+  return complete;
+}
+
 
-    while (scanf("%d %d %d %s\n", &pid, &ppid, &uid, comm) == 4) {
-        if (cmd = strrchr(comm, '/'))
+/*
+ * Reads the processes from name, or standard input if name is "-",
+ * instead of /proc.  Each line holds
+ *     pid ppid uid command [ args ... ]
+ * as written by  ps -eo pid,ppid,uid,args  or  ps -eo pid,ppid,uid,comm.
+ * Lines that don't start with three numbers, like headers, are skipped.
+ */
+static void read_input(const char *name)
+{
+    FILE *file;
+    char comm[COMM_LEN + 1];
+    char *buf = NULL, *args, *src, *dst, *cmd;
+    size_t buf_size = 0;
+    ssize_t len;
+    int pid, ppid, uid, offset, empty;
+
+    if (!strcmp(name, "-"))
+        file = stdin;
+    else if (!(file = fopen(name, "r"))) {
+        perror(name);
+        exit(1);
+    }
+    empty = 1;
+    while ((len = getline(&buf, &buf_size, file)) >= 0) {
+        if (sscanf(buf, "%d %d %d %n", &pid, &ppid, &uid, &offset) < 3
+            || !buf[offset])
+            continue;
+        /* room for the two NULs that end a cmdline read by read_pid */
+        if (buf_size < (size_t) len + 2
+            && !(buf = realloc(buf, buf_size = len + 2))) {
+            perror("realloc");
+            exit(1);
+        }
+        /* split the command into NUL separated words, like cmdline */
+        args = buf + offset;
+        for (src = dst = args; *src;)
+            if (!isspace((unsigned char) *src))
+                *dst++ = *src++;
+            else {
+                while (isspace((unsigned char) *src))
+                    src++;
+                if (*src)
+                    *dst++ = 0;
+            }
+        *dst++ = 0;
+        *dst++ = 0;
+        if ((cmd = strrchr(args, '/')))
             cmd++;
         else
-            cmd = comm;
+            cmd = args;
         if (*cmd == '-')
             cmd++;
+        sprintf(comm, "%.*s", COMM_LEN, cmd);
 #ifdef WITH_SELINUX
-        add_proc(cmd, pid, ppid, uid, NULL, 0, NULL);
+        add_proc(comm, pid, ppid, uid, print_args ? args : NULL,
+                 dst - args, 0, NULL);
 #else                                /*WITH_SELINUX */
-        add_proc(cmd, pid, ppid, uid, NULL, 0);
+        add_proc(comm, pid, ppid, uid, print_args ? args : NULL,
+                 dst - args, 0);
 #endif                                /*WITH_SELINUX */
+        empty = 0;
+    }
+    free(buf);
+    if (file != stdin)
+        (void) fclose(file);
+    if (empty) {
+        fprintf(stderr, _("%s: no processes found\n"), name);
+        exit(1);
     }
 }
 
-#endif
+/*
+ * Reads the processes from a snapshot written by --save-snapshot instead
+ * of /proc, the same way read_pid would have read them at the time.
+ */
+static void read_snapshot(const char *name)
+{
+    struct snapshot *snap;
+    const struct snapshot_record *rec;
+    const char *comm, *fields;
+    char threadname[COMM_LEN + 2 + 1];
+    struct rollup own;
+    long num_threads;
+    pid_t ppid;
+    uint32_t i;
+    int size;
+
+    snap = snapshot_open(name);
+    if (!snap->header->count) {
+        fprintf(stderr, _("%s: no processes found\n"), name);
+        exit(1);
+    }
+    start_read();
+    for (i = 0, rec = snap->records; i < snap->header->count; i++, rec++) {
+        comm = snapshot_string(snap, rec->comm);
+        if (rec->tgid != rec->pid) {
+            if (hide_threads)
+                continue;
+            sprintf(threadname, "{%.*s}", COMM_LEN, comm);
+#ifdef WITH_SELINUX
+            add_proc(threadname, rec->pid, rec->tgid, rec->uid,
+                     print_args ? threadname : NULL,
+                     strlen(threadname) + 1, 1, NULL);
+#else                                /*WITH_SELINUX */
+            add_proc(threadname, rec->pid, rec->tgid, rec->uid,
+                     print_args ? threadname : NULL,
+                     strlen(threadname) + 1, 1);
+#endif                                /*WITH_SELINUX */
+            continue;
+        }
+        size = 0;
+        if (print_args) {
+            /* cut to the screen like read_pid does */
+            if ((size = rec->cmdline_len) > cmd_buffer_size)
+                size = cmd_buffer_size;
+            memcpy(cmd_buffer, snapshot_string(snap, rec->cmdline), size);
+            if (size >= cmd_buffer_size)
+                size--;
+            if (size)
+                cmd_buffer[size++] = 0;
+        }
+        fields = strrchr(snapshot_string(snap, rec->stat), ')');
+        if (!fields || parse_stat(fields + 2, &ppid, &num_threads, &own) < 0)
+            memset(&own, 0, sizeof(own));
+#ifdef WITH_SELINUX
+        add_proc(comm, rec->pid, rec->ppid, rec->uid,
+                 print_args ? cmd_buffer : NULL, size, 0, NULL)->own = own;
+#else                                /*WITH_SELINUX */
+        add_proc(comm, rec->pid, rec->ppid, rec->uid,
+                 print_args ? cmd_buffer : NULL, size, 0)->own = own;
+#endif                                /*WITH_SELINUX */
+    }
+    end_read();
+    snapshot_close(snap);
+}
+
+static pid_t next_cgroup;        /* pseudo PID of the next cgroup node */
+
+/*
+ * Files the processes and threads listed in name, cgroup.procs or
+ * cgroup.threads of the cgroup directory dir_fd, under its node.
+ */
+static void read_cgroup_members(int dir_fd, const char *name, PROC * node)
+{
+    FILE *file;
+    PROC *member;
+    long id;
+    int fd;
+
+    if ((fd = openat(dir_fd, name, O_RDONLY)) < 0)
+        return;
+    if (!(file = fdopen(fd, "r"))) {
+        (void) close(fd);
+        return;
+    }
+    while (fscanf(file, "%ld", &id) == 1)
+        if ((member = find_proc((pid_t) id)))
+            member->cgroup = node;
+    (void) fclose(file);
+}
+
+/*
+ * Adds a node for the cgroup directory dir_fd, called name, below parent
+ * and does the same for all cgroups below it.  Each cgroup is one file
+ * to read, however many processes it holds.
+ */
+static void read_cgroup(int dir_fd, const char *name, PROC * parent)
+{
+    char comm[COMM_LEN + 1];
+    PROC *node;
+    DIR *dir;
+    struct dirent *de;
+    int fd;
 
+    sprintf(comm, "%.*s", COMM_LEN, name);
+#ifdef WITH_SELINUX
+    node = new_proc(comm, next_cgroup--, 0, NULL);
+#else                                /*WITH_SELINUX */
+    node = new_proc(comm, next_cgroup--, 0);
+#endif                                /*WITH_SELINUX */
+    node->flags |= PFLAG_CGROUP;
+    node->cgroup_name = arena_alloc(strlen(name) + 2);
+    sprintf(node->cgroup_name, "%s/", name);
+    node->parent = parent;
+    read_cgroup_members(dir_fd, "cgroup.procs", node);
+    if (!hide_threads)
+        read_cgroup_members(dir_fd, "cgroup.threads", node);
+
+    if ((fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY)) < 0)
+        return;
+    if (!(dir = fdopendir(fd))) {
+        (void) close(fd);
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if ((de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+            || !strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if ((fd = openat(dir_fd, de->d_name, O_RDONLY | O_DIRECTORY)) >= 0) {
+            read_cgroup(fd, de->d_name, node);
+            (void) close(fd);
+        }
+    }
+    (void) closedir(dir);
+}
+
+/*
+ * Opens the cgroup v2 hierarchy, which hybrid setups mount below the v1
+ * ones.
+ */
+static int open_cgroup_root(void)
+{
+    static const char *const paths[] = { CGROUP_BASE, CGROUP_BASE "/unified" };
+    unsigned int i;
+    int fd;
+
+    for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        if ((fd = open(paths[i], O_RDONLY | O_DIRECTORY)) < 0)
+            continue;
+        if (faccessat(fd, "cgroup.controllers", F_OK, 0) == 0)
+            return fd;
+        (void) close(fd);
+    }
+    return -1;
+}
+
+/*
+ * With -C, hangs the processes read so far below nodes for the cgroups
+ * of the v2 hierarchy they are in.  A process stays below its parent if
+ * that is in the same cgroup, so each service keeps its own tree.
+ */
+static void read_cgroups(void)
+{
+    PROC *walk;
+    int fd;
+
+    if ((fd = open_cgroup_root()) < 0) {
+        fprintf(stderr, _("%s: no cgroup v2 hierarchy found\n"), CGROUP_BASE);
+        exit(1);
+    }
+    next_cgroup = CGROUP_ROOT;
+    read_cgroup(fd, "", NULL);
+    (void) close(fd);
+    for (walk = list; walk; walk = walk->next)
+        if (walk->cgroup && (!walk->parent
+                             || walk->parent->cgroup != walk->cgroup))
+            walk->parent = walk->cgroup;
+}
+
+/*
+ * Reads the processes to show, only the subtree below pid if possible.
+ */
+static void read_tree(pid_t pid, pid_t highlight)
+{
+  if (input_name)
+    read_input(input_name);
+  else if (snapshot_name)
+    read_snapshot(snapshot_name);
+  else if (show_cgroups) {
+    read_proc();
+    read_cgroups();
+  } else if (pid == 1 || !read_subtree(pid, highlight))
+    read_proc();
+}
+
+/*
+ * Turns the processes read so far into the tree to show and returns the
+ * process to start the dump at.
+ */
+static PROC *build_tree(pid_t pid, pid_t highlight)
+{
+    PROC *current;
+
+    link_children();
+    for (current = find_proc(highlight); current;
+         current = current->parent)
+        current->flags |= PFLAG_HILIGHT;
+
+    if(show_parents && pid != 0) {
+      trim_tree_by_parent(find_proc(pid));
+
+      pid = show_cgroups ? CGROUP_ROOT : 1;
+    }
+    if (compact)
+        for (current = list; current; current = current->next)
+            if (!current->parent)
+                (void) hash_tree(current);
+    return find_proc(pid);
+}
+
+#ifdef HAVE_LINUX_CN_PROC_H
+/*
+ * With --watch the tree is read once and then kept up to date from the
+ * events of the proc connector.  Events are only collected as they come
+ * in; at each refresh update_tree reads again just the processes they
+ * name, so the /proc traffic follows the churn, not the number of
+ * processes.
+ */
+static struct pid_list dirty_pids;        /* changed, see mark_dirty */
+static struct pid_list exiting_pids;        /* exited, maybe not reaped yet */
+static int tree_changed = 0;
+static int events_lost = 0;
+static int stale_count = 0;        /* arena space wasted on old PROCs and args */
+
+static int open_proc_events(void)
+{
+  char buf[NLMSG_SPACE(sizeof(struct cn_msg) +
+                       sizeof(enum proc_cn_mcast_op))];
+  struct nlmsghdr *hdr = (struct nlmsghdr *) buf;
+  struct cn_msg *msg;
+  struct sockaddr_nl addr;
+  enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  int sock;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  memset(buf, 0, sizeof(buf));
+  hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+  hdr->nlmsg_type = NLMSG_DONE;
+  msg = NLMSG_DATA(hdr);
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(op);
+  memcpy(msg->data, &op, sizeof(op));
+  if ((sock = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR)) < 0
+      || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+      || send(sock, buf, hdr->nlmsg_len, 0) < 0) {
+    fprintf(stderr, _("Can't listen to process events: %s\n"),
+            strerror(errno));
+    exit(1);
+  }
+  return sock;
+}
+
+static void mark_dirty(PROC * proc)
+{
+  if (proc && !(proc->flags & PFLAG_DIRTY)) {
+    proc->flags |= PFLAG_DIRTY;
+    push_pid(&dirty_pids, proc->pid);
+  }
+}
+
+/*
+ * Collects the events waiting on sock.
+ */
+static void read_proc_events(int sock)
+{
+  char buf[8192] __attribute__ ((aligned(NLMSG_ALIGNTO)));
+  struct nlmsghdr *hdr;
+  struct proc_event *ev;
+  PROC *proc;
+  int len;
+
+  if ((len = recv(sock, buf, sizeof(buf), 0)) < 0) {
+    if (errno == ENOBUFS)        /* the kernel dropped some */
+      events_lost = 1;
+    return;
+  }
+  for (hdr = (struct nlmsghdr *) buf; NLMSG_OK(hdr, len);
+       hdr = NLMSG_NEXT(hdr, len)) {
+    if (hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_NOOP)
+      continue;
+    ev = (struct proc_event *) ((struct cn_msg *) NLMSG_DATA(hdr))->data;
+    switch (ev->what) {
+    case PROC_EVENT_FORK:
+      if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid) {
+        if (!hide_threads)
+          mark_dirty(find_proc(ev->event_data.fork.child_tgid));
+      } else if ((proc = find_proc(ev->event_data.fork.parent_tgid))) {
+        /* a copy of the parent until it is read, so its own children
+           can be attached to it right away */
+#ifdef WITH_SELINUX
+        add_proc(proc->comm, ev->event_data.fork.child_tgid, proc->pid,
+                 proc->uid, NULL, 0, 0, proc->scontext);
+#else                /*WITH_SELINUX */
+        add_proc(proc->comm, ev->event_data.fork.child_tgid, proc->pid,
+                 proc->uid, NULL, 0, 0);
+#endif                /*WITH_SELINUX */
+        mark_dirty(find_proc(ev->event_data.fork.child_tgid));
+      }
+      break;
+    case PROC_EVENT_EXEC:
+      mark_dirty(find_proc(ev->event_data.exec.process_tgid));
+      break;
+    case PROC_EVENT_UID:
+      mark_dirty(find_proc(ev->event_data.id.process_tgid));
+      break;
+    case PROC_EVENT_COMM:
+      /* threads are shown with the name of their process */
+      if (ev->event_data.comm.process_pid == ev->event_data.comm.process_tgid)
+        mark_dirty(find_proc(ev->event_data.comm.process_tgid));
+      break;
+    case PROC_EVENT_EXIT:
+      if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+        push_pid(&exiting_pids, ev->event_data.exit.process_pid);
+      else if ((proc = find_proc(ev->event_data.exit.process_pid))
+               && (proc->flags & PFLAG_THREAD)) {
+        remove_proc(proc);
+        stale_count++;
+        tree_changed = 1;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/*
+ * Reads pid again, or removes it if it is gone. Returns 0 if it is gone.
+ */
+static int update_proc(int proc_fd, pid_t pid)
+{
+  char pid_dir[16];
+  long num_threads;
+  PROC *proc;
+
+  sprintf(pid_dir, "%d", (int) pid);
+  stale_count++;
+  if (read_pid(proc_fd, pid_dir, pid, 1, &num_threads) >= 0)
+    return 1;
+  if ((proc = find_proc(pid))) {
+    remove_proc(proc);
+    tree_changed = 1;
+  }
+  return 0;
+}
+
+/*
+ * Applies the events collected since the last refresh.  Exited processes
+ * are only removed once they have been reaped, since zombies are shown
+ * too, but their children have been given to a new parent right away.
+ */
+static void update_tree(int proc_fd, pid_t pid, pid_t highlight)
+{
+  PROC *proc, *walk;
+  int i, kept, removed, exited;
+
+  start_read();
+  removed = 0;
+  for (i = 0; i < dirty_pids.len; i++)
+    if ((proc = find_proc(dirty_pids.pids[i]))) {
+      proc->flags &= ~PFLAG_DIRTY;
+      tree_changed = 1;
+      if (!update_proc(proc_fd, proc->pid))
+        removed = 1;
+    }
+  dirty_pids.len = 0;
+  exited = 0;
+  for (i = kept = 0; i < exiting_pids.len; i++)
+    if ((proc = find_proc(exiting_pids.pids[i]))) {
+      proc->flags |= PFLAG_EXITING;
+      exited = 1;
+      if (update_proc(proc_fd, proc->pid))
+        exiting_pids.pids[kept++] = proc->pid;
+      else
+        removed = 1;
+    }
+  exiting_pids.len = kept;
+  /* find the new parents of orphans, drop the threads of the dead */
+  while (removed || exited) {
+    removed = exited = 0;
+    for (walk = list; walk; walk = walk->next)
+      if (walk->parent
+          && (walk->parent->flags & (PFLAG_DEAD | PFLAG_EXITING))) {
+        if (!(walk->flags & PFLAG_THREAD)) {
+          if (!update_proc(proc_fd, walk->pid))
+            removed = 1;
+        } else if (walk->parent->flags & PFLAG_DEAD) {
+          remove_proc(walk);
+          stale_count++;
+        }
+      }
+  }
+  for (i = 0; i < exiting_pids.len; i++)
+    if ((proc = find_proc(exiting_pids.pids[i])))
+      proc->flags &= ~PFLAG_EXITING;
+  end_read();
+
+  /* start over once the arena holds more garbage than processes */
+  if (events_lost || stale_count > proc_count + 1024) {
+    free_tree();
+    dirty_pids.len = exiting_pids.len = 0;
+    events_lost = stale_count = 0;
+    read_tree(pid, highlight);
+    tree_changed = 1;
+  }
+}
+
+/*
+ * Shows the tree below pid (or the trees of user pw) and refreshes it
+ * every interval seconds if anything has changed.  Never returns.
+ */
+static void watch_tree(pid_t pid, pid_t highlight, const struct passwd *pw,
+                       int interval, const char *clear)
+{
+  struct pollfd pfd;
+  struct timespec now, next;
+  PROC *walk;
+  int proc_fd, timeout;
+
+  pfd.fd = open_proc_events();
+  pfd.events = POLLIN;
+  if ((proc_fd = open(PROC_BASE, O_RDONLY | O_DIRECTORY)) < 0) {
+    perror(PROC_BASE);
+    exit(1);
+  }
+  read_tree(pid, highlight);
+  tree_changed = 1;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (;;) {
+    if (tree_changed) {
+      for (walk = list; walk; walk = walk->next) {
+        walk->nchildren = 0;
+        walk->flags &= ~PFLAG_HILIGHT;
+      }
+      walk = build_tree(pid, highlight);
+      if (output_format == FORMAT_TEXT) {
+        if (clear)
+          tputs(clear, 1, putchar);
+        else
+          putchar('\n');
+      }
+      show_tree(walk, pw);
+      fflush(stdout);
+      tree_changed = 0;
+    }
+    next.tv_sec += interval;
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      timeout = (next.tv_sec - now.tv_sec) * 1000 +
+          (next.tv_nsec - now.tv_nsec) / 1000000;
+      if (timeout < 0)
+        timeout = 0;
+      if (poll(&pfd, 1, timeout) > 0)
+        read_proc_events(pfd.fd);
+    } while (timeout > 0);
+    update_tree(proc_fd, pid, highlight);
+  }
+}
+#endif                                /*HAVE_LINUX_CN_PROC_H */
 
 static void usage(void)
 {
     fprintf(stderr,
             _
-            ("Usage: pstree [ -a ] [ -c ] [ -h | -H PID ] [ -l ] [ -n ] [ -p ] [ -u ]\n"
-             "              [ -A | -G | -U ] [ PID | USER ]\n"
+            ("Usage: pstree [ -a ] [ -c ] [ -C ] [ -F FORMAT ] [ -h | -H PID ]\n"
+             "              [ -I FILE ] [ -l ] [ -n ] [ -N ] [ -p ] [ -P ] [ -R ]\n"
+             "              [ -S KEY ] [ -T ] [ -u ] [ -W[SECS] ] [ -A | -G | -U ]\n"
+             "              [ PID | USER ]\n"
              "       pstree -V\n" "Display a tree of processes.\n\n"
              "  -a, --arguments     show command line arguments\n"
              "  -A, --ascii         use ASCII line drawing characters\n"
              "  -c, --compact       don't compact identical subtrees\n"
+             "  -C, --cgroups       show processes below their cgroups (v2)\n"
+             "  -F FORMAT,\n"
+             "  --format=FORMAT     write json, ndjson or tsv records instead of a tree\n"
              "  -h, --highlight-all highlight current process and its ancestors\n"
              "  -H PID,\n"
              "  --highlight-pid=PID highlight this process and its ancestors\n"
+             "  -I FILE,\n"
+             "  --input=FILE        read \"pid ppid uid command\" lines instead of /proc\n"
+             "  --save-snapshot=FILE\n"
+             "                      save all processes to FILE for --snapshot and exit\n"
+             "  --snapshot=FILE     read processes saved by --save-snapshot\n"
              "  -G, --vt100         use VT100 line drawing characters\n"
              "  -l, --long          don't truncate long lines\n"
              "  -n, --numeric-sort  sort output by PID\n"
+             "  -N, --numeric-uids  show uids as numbers, don't look up user names\n"
              "  -p, --show-pids     show PIDs; implies -c\n"
+             "  -P, --ns-pids       show PIDs as seen in their own PID namespace;\n"
+             "                      implies -p\n"
+             "  -R, --rollups       show RSS, CPU time and threads of each subtree;\n"
+             "                      implies -c\n"
              "  -s, --show-parents  show parents of the selected process\n"
+             "  -S KEY,\n"
+             "  --sort=KEY          sort by the rss, cpu or threads of each subtree\n"
+             "  -T, --hide-threads  hide threads, show only processes\n"
              "  -u, --uid-changes   show uid transitions\n"
              "  -U, --unicode       use UTF-8 (Unicode) line drawing characters\n"
-             "  -V, --version       display version information\n"));
+             "  -V, --version       display version information\n"
+             "  -W, --watch[=SECS]  keep showing the tree, updated every SECS (1)\n"));
 #ifdef WITH_SELINUX
     fprintf(stderr,
             _("  -Z     show         SELinux security contexts\n"));
@@ -837,21 +2540,36 @@ int main(int argc, char **argv)
     char termcap_area[1024];
     char *termname;
     int c;
+#ifdef HAVE_LINUX_CN_PROC_H
+    const char *clear = NULL;
+    int watch_interval = 0;
+#endif                                /*HAVE_LINUX_CN_PROC_H */
 
     struct option options[] = {
         {"arguments", 0, NULL, 'a'},
         {"ascii", 0, NULL, 'A'},
         {"compact", 0, NULL, 'c'},
+        {"cgroups", 0, NULL, 'C'},
+        {"format", 1, NULL, 'F'},
         {"vt100", 0, NULL, 'G'},
         {"highlight-all", 0, NULL, 'h'},
         {"highlight-pid", 1, NULL, 'H'},
+        {"input", 1, NULL, 'I'},
         {"long", 0, NULL, 'l'},
         {"numeric-sort", 0, NULL, 'n'},
+        {"numeric-uids", 0, NULL, 'N'},
+        {"ns-pids", 0, NULL, 'P'},
+        {"rollups", 0, NULL, 'R'},
+        {"sort", 1, NULL, 'S'},
         {"show-pids", 0, NULL, 'p'},
         {"show-parents", 0, NULL, 's'},
+        {"hide-threads", 0, NULL, 'T'},
         {"uid-changes", 0, NULL, 'u'},
         {"unicode", 0, NULL, 'U'},
         {"version", 0, NULL, 'V'},
+        {"watch", 2, NULL, 'W'},
+        {"snapshot", 1, NULL, OPT_SNAPSHOT},
+        {"save-snapshot", 1, NULL, OPT_SAVE_SNAPSHOT},
 #ifdef WITH_SELINUX
         {"security-context", 0, NULL, 'Z'},
 #endif                                /*WITH_SELINUX */
@@ -861,7 +2579,7 @@ int main(int argc, char **argv)
     if (ioctl(1, TIOCGWINSZ, &winsz) >= 0)
         if (winsz.ws_col)
             output_width = winsz.ws_col;
-    pid = 1;
+    pid = 0;
     highlight = 0;
     pw = NULL;
 
@@ -901,11 +2619,12 @@ int main(int argc, char **argv)
 
 #ifdef WITH_SELINUX
     while ((c =
-            getopt_long(argc, argv, "aAcGhH:nplsuUVZ", options,
+            getopt_long(argc, argv, "aAcCF:GhH:I:nNpPRlsS:TuUVW::Z", options,
                         NULL)) != -1)
 #else                                /*WITH_SELINUX */
     while ((c =
-            getopt_long(argc, argv, "aAcGhH:nplsuUV", options, NULL)) != -1)
+            getopt_long(argc, argv, "aAcCF:GhH:I:nNpPRlsS:TuUVW::", options,
+                        NULL)) != -1)
 #endif                                /*WITH_SELINUX */
         switch (c) {
         case 'a':
@@ -917,6 +2636,19 @@ int main(int argc, char **argv)
         case 'c':
             compact = 0;
             break;
+        case 'C':
+            show_cgroups = 1;
+            break;
+        case 'F':
+            if (!strcmp(optarg, "json"))
+                output_format = FORMAT_JSON;
+            else if (!strcmp(optarg, "ndjson"))
+                output_format = FORMAT_NDJSON;
+            else if (!strcmp(optarg, "tsv"))
+                output_format = FORMAT_TSV;
+            else if (strcmp(optarg, "text"))
+                usage();
+            break;
         case 'G':
             sym = &sym_vt100;
             break;
@@ -941,19 +2673,47 @@ int main(int argc, char **argv)
             if (!(highlight = atoi(optarg)))
                 usage();
             break;
+        case 'I':
+            input_name = optarg;
+            break;
         case 'l':
             trunc = 0;
             break;
         case 'n':
             by_pid = 1;
             break;
+        case 'N':
+            numeric_uids = 1;
+            break;
         case 'p':
             pids = 1;
             compact = 0;
             break;
+        case 'P':
+            show_ns_pids = 1;
+            pids = 1;
+            compact = 0;
+            break;
+        case 'R':
+            show_rollups = 1;
+            compact = 0;
+            break;
         case 's':
             show_parents = 1;
             break;
+        case 'S':
+            if (!strcmp(optarg, "rss"))
+                sort_key = SORT_RSS;
+            else if (!strcmp(optarg, "cpu"))
+                sort_key = SORT_CPU;
+            else if (!strcmp(optarg, "threads"))
+                sort_key = SORT_THREADS;
+            else
+                usage();
+            break;
+        case 'T':
+            hide_threads = 1;
+            break;
         case 'u':
             user_change = 1;
             break;
@@ -963,6 +2723,21 @@ int main(int argc, char **argv)
         case 'V':
             print_version();
             return 0;
+        case 'W':
+#ifdef HAVE_LINUX_CN_PROC_H
+            if ((watch_interval = optarg ? atoi(optarg) : 1) < 1)
+                usage();
+            break;
+#else                                /*HAVE_LINUX_CN_PROC_H */
+            fprintf(stderr, _("Watching is not supported on this system\n"));
+            return 1;
+#endif                                /*HAVE_LINUX_CN_PROC_H */
+        case OPT_SNAPSHOT:
+            snapshot_name = optarg;
+            break;
+        case OPT_SAVE_SNAPSHOT:
+            snapshot_save(optarg);
+            return 0;
 #ifdef WITH_SELINUX
         case 'Z':
             if (is_selinux_enabled() > 0)
@@ -987,27 +2762,45 @@ int main(int argc, char **argv)
     }
     if (optind != argc)
         usage();
-    read_proc();
-    for (current = find_proc(highlight); current;
-         current = current->parent)
-        current->flags |= PFLAG_HILIGHT;
-
-    if(show_parents && pid != 0) {
-      trim_tree_by_parent(find_proc(pid));
-
-      pid = 1;
+    if (show_cgroups && (input_name || snapshot_name))
+        usage();
+    if (!pid)
+        pid = show_cgroups ? CGROUP_ROOT : 1;
+    if (output_format != FORMAT_TEXT)
+        trunc = 0;              /* records are never cut to the screen */
+    page_size = sysconf(_SC_PAGESIZE);
+    clk_tck = sysconf(_SC_CLK_TCK);
+    if (input_name || snapshot_name)
+        show_ns_pids = 0;
+    if (show_ns_pids) {
+        struct stat st;
+
+        if (stat(PROC_BASE "/self/ns/pid", &st) == 0)
+            own_pid_ns = find_pid_ns(st.st_ino);
     }
-
-    if (!pw)
-        dump_tree(find_proc(pid), 0, 1, 1, 1, 0, 0);
-    else {
-        dump_by_user(find_proc(1), pw->pw_uid);
-        if (!dumped) {
-            fprintf(stderr, _("No processes found.\n"));
-            return 1;
-        }
+#ifdef WITH_SELINUX
+    if (input_name || snapshot_name)
+        show_scontext = 0;
+#endif                                /*WITH_SELINUX */
+#ifdef HAVE_LINUX_CN_PROC_H
+    if (watch_interval) {
+        if (input_name || snapshot_name || show_cgroups)
+            usage();
+        if (getenv("TERM") && tgetent(termcap_area, getenv("TERM")) > 0)
+            clear = tgetstr("cl", NULL);
+        watch_tree(pid, highlight, pw, watch_interval, clear);
+    }
+#endif                                /*HAVE_LINUX_CN_PROC_H */
+    read_tree(pid, highlight);
+    current = build_tree(pid, highlight);
+
+    show_tree(current, pw);
+    if (pw && !dumped) {
+        fprintf(stderr, _("No processes found.\n"));
+        return 1;
     }
     free_buffers();
+    free_tree();
     if (wait_end == 1) {
         fprintf(stderr, _("Press return to close\n"));
         (void) getchar();
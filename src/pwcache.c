@@ -0,0 +1,67 @@
+/*
+ * pwcache.c - cached user name lookup
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pwd.h>
+#include <sys/types.h>
+
+#include "pwcache.h"
+
+
+#define HASH_SIZE 64
+
+typedef struct _pwentry
+{
+  uid_t uid;
+  char *name;			/* NULL if there is no passwd entry */
+  struct _pwentry *next;
+}
+PWENTRY;
+
+static PWENTRY *pwhash[HASH_SIZE];
+
+
+const char *
+get_username (uid_t uid)
+{
+  PWENTRY *entry;
+  struct passwd *pw;
+  unsigned int bucket = uid % HASH_SIZE;
+
+  for (entry = pwhash[bucket]; entry; entry = entry->next)
+    if (entry->uid == uid)
+      return entry->name;
+  if (!(entry = malloc (sizeof (PWENTRY))))
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  entry->uid = uid;
+  entry->name = NULL;
+  if ((pw = getpwuid (uid)) && !(entry->name = strdup (pw->pw_name)))
+    {
+      perror ("strdup");
+      exit (1);
+    }
+  entry->next = pwhash[bucket];
+  pwhash[bucket] = entry;
+  return entry->name;
+}
@@ -0,0 +1,17 @@
+/* pwcache.h - cached user name lookup */
+
+/* See file COPYING for copying conditions. */
+
+
+#ifndef PWCACHE_H
+#define PWCACHE_H
+
+#include <sys/types.h>
+
+const char *get_username (uid_t uid);
+
+/* Returns the login name of UID, or NULL if UID has no passwd entry. The
+   name service is asked at most once per UID, the answer is kept for the
+   rest of the run. */
+
+#endif
@@ -0,0 +1,394 @@
+/*
+ * snapshot.c - saved process table
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "i18n.h"
+#include "snapshot.h"
+
+
+#define PROC_BASE "/proc"
+
+/* the snapshot being built by snapshot_save */
+static struct snapshot_record *records = NULL;
+static size_t count = 0, records_size = 0;
+static char *strings = NULL;
+static size_t strings_len = 0, strings_size = 0;
+
+/* file contents read by read_file */
+static char *buf = NULL;
+static size_t buf_size = 0;
+
+
+static void
+grow_buf (size_t need)
+{
+  if (need <= buf_size)
+    return;
+  while (buf_size < need)
+    buf_size = buf_size ? buf_size * 2 : BUFSIZ;
+  if (!(buf = realloc (buf, buf_size)))
+    {
+      perror ("realloc");
+      exit (1);
+    }
+}
+
+
+static uint32_t
+add_string (const char *str, size_t len)
+{
+  size_t offset = strings_len;
+
+  if (!len)
+    return 0;
+  if (strings_len + len + 1 > strings_size)
+    {
+      while (strings_len + len + 1 > strings_size)
+	strings_size *= 2;
+      if (strings_size > UINT32_MAX)
+	{
+	  fprintf (stderr, _("Too many processes for a snapshot\n"));
+	  exit (1);
+	}
+      if (!(strings = realloc (strings, strings_size)))
+	{
+	  perror ("realloc");
+	  exit (1);
+	}
+    }
+  memcpy (strings + offset, str, len);
+  strings[offset + len] = 0;
+  strings_len += len + 1;
+  return offset;
+}
+
+
+static struct snapshot_record *
+new_record (void)
+{
+  if (count == records_size)
+    {
+      records_size = records_size ? records_size * 2 : 256;
+      if (!(records = realloc (records, records_size * sizeof *records)))
+	{
+	  perror ("realloc");
+	  exit (1);
+	}
+    }
+  memset (&records[count], 0, sizeof *records);
+  return &records[count++];
+}
+
+
+/* Reads the file name below the directory dir_fd into buf, followed by a
+   NUL. Returns its length or -1. */
+static ssize_t
+read_file (int dir_fd, const char *name)
+{
+  ssize_t len = 0, got;
+  int fd;
+
+  if ((fd = openat (dir_fd, name, O_RDONLY)) < 0)
+    return -1;
+  for (;;)
+    {
+      grow_buf (len + BUFSIZ);
+      if ((got = read (fd, buf + len, buf_size - len - 1)) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  (void) close (fd);
+	  return -1;
+	}
+      if (!got)
+	break;
+      len += got;
+    }
+  (void) close (fd);
+  buf[len] = 0;
+  return len;
+}
+
+
+static void
+save_process (int pid_fd, pid_t pid)
+{
+  struct snapshot_record *rec;
+  struct stat st;
+  DIR *taskdir;
+  struct dirent *de;
+  char *comm, *end;
+  ssize_t len;
+  uint32_t comm_offset;
+  long num_threads;
+  int ppid, pgrp, fd;
+  pid_t tid;
+  uid_t uid;
+
+  if (fstat (pid_fd, &st) < 0 || (len = read_file (pid_fd, "stat")) <= 0)
+    return;			/* exited meanwhile */
+  /* commands may have spaces or ) in them, so only the last ) ends it */
+  if (!(comm = strchr (buf, '(')) || !(end = strrchr (comm, ')'))
+      || sscanf (end + 1, " %*c %d %d %*d %*d %*d %*u %*u %*u %*u %*u "
+		 "%*u %*u %*d %*d %*d %*d %ld", &ppid, &pgrp,
+		 &num_threads) < 3)
+    return;
+  rec = new_record ();
+  rec->pid = rec->tgid = pid;
+  rec->ppid = ppid;
+  rec->pgrp = pgrp;
+  rec->uid = uid = st.st_uid;
+  rec->stat = add_string (buf, len);
+  rec->comm = comm_offset = add_string (comm + 1, end - comm - 1);
+  if ((len = read_file (pid_fd, "cmdline")) > 0)
+    {
+      rec->cmdline = add_string (buf, len);
+      rec->cmdline_len = len;
+    }
+  /* the executable is only readable for our own processes unless root */
+  if (fstatat (pid_fd, "exe", &st, 0) == 0)
+    {
+      rec->exe_dev = st.st_dev;
+      rec->exe_ino = st.st_ino;
+      grow_buf (PATH_MAX + 1);
+      if ((len = readlinkat (pid_fd, "exe", buf, buf_size)) > 0
+	  && (size_t) len < buf_size)
+	rec->exe = add_string (buf, len);
+    }
+  if (num_threads == 1
+      || (fd = openat (pid_fd, "task", O_RDONLY | O_DIRECTORY)) < 0)
+    return;
+  if (!(taskdir = fdopendir (fd)))
+    {
+      (void) close (fd);
+      return;
+    }
+  while ((de = readdir (taskdir)) != NULL)
+    if ((tid = (pid_t) atoi (de->d_name)) != 0 && tid != pid)
+      {
+	rec = new_record ();
+	rec->pid = tid;
+	rec->tgid = pid;
+	rec->ppid = ppid;
+	rec->pgrp = pgrp;
+	rec->uid = uid;
+	rec->comm = comm_offset;
+      }
+  (void) closedir (taskdir);
+}
+
+
+static int
+compare_records (const void *a, const void *b)
+{
+  const struct snapshot_record *rec_a = a, *rec_b = b;
+
+  return (rec_a->pid > rec_b->pid) - (rec_a->pid < rec_b->pid);
+}
+
+
+static void
+write_snapshot (const char *path)
+{
+  struct snapshot_header header;
+  FILE *file = NULL;
+  char *tmp;
+  int fd;
+
+  memset (&header, 0, sizeof header);
+  strncpy (header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+  header.version = SNAPSHOT_VERSION;
+  header.record_size = sizeof (struct snapshot_record);
+  header.count = count;
+  header.strings_size = strings_len;
+
+  /* written aside and renamed, so readers never see half a snapshot */
+  if (asprintf (&tmp, "%s.XXXXXX", path) < 0)
+    {
+      perror ("asprintf");
+      exit (1);
+    }
+  if ((fd = mkstemp (tmp)) < 0)
+    {
+      perror (tmp);
+      exit (1);
+    }
+  if (!(file = fdopen (fd, "w"))
+      || fwrite (&header, sizeof header, 1, file) != 1
+      || fwrite (records, sizeof *records, count, file) != count
+      || fwrite (strings, 1, strings_len, file) != strings_len
+      || fclose (file) != 0 || rename (tmp, path) < 0)
+    {
+      perror (path);
+      (void) unlink (tmp);
+      exit (1);
+    }
+  free (tmp);
+}
+
+
+void
+snapshot_save (const char *path)
+{
+  DIR *dir;
+  struct dirent *de;
+  pid_t pid;
+  int fd;
+
+  if (!(dir = opendir (PROC_BASE)))
+    {
+      perror (PROC_BASE);
+      exit (1);
+    }
+  strings_size = BUFSIZ;
+  if (!(strings = malloc (strings_size)))
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  strings[0] = 0;		/* offset 0 is the empty string */
+  strings_len = 1;
+  while ((de = readdir (dir)) != NULL)
+    if ((pid = (pid_t) atoi (de->d_name)) != 0
+	&& (fd = openat (dirfd (dir), de->d_name,
+			 O_RDONLY | O_DIRECTORY)) >= 0)
+      {
+	save_process (fd, pid);
+	(void) close (fd);
+      }
+  (void) closedir (dir);
+  if (!count)
+    {
+      fprintf (stderr, _("%s is empty (not mounted ?)\n"), PROC_BASE);
+      exit (1);
+    }
+  qsort (records, count, sizeof *records, compare_records);
+  write_snapshot (path);
+  free (records);
+  free (strings);
+  free (buf);
+  records = NULL;
+  strings = buf = NULL;
+  count = records_size = strings_len = strings_size = buf_size = 0;
+}
+
+
+struct snapshot *
+snapshot_open (const char *path)
+{
+  const struct snapshot_header *header;
+  const struct snapshot_record *rec;
+  struct snapshot *snap;
+  struct stat st;
+  void *map;
+  uint32_t i, size;
+  int fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0 || fstat (fd, &st) < 0)
+    {
+      perror (path);
+      exit (1);
+    }
+  if ((size_t) st.st_size < sizeof *header)
+    goto bad;
+  if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+      == MAP_FAILED)
+    {
+      perror (path);
+      exit (1);
+    }
+  (void) close (fd);
+  if (!(snap = malloc (sizeof *snap)))
+    {
+      perror ("malloc");
+      exit (1);
+    }
+  snap->header = header = map;
+  snap->records = (const struct snapshot_record *) (header + 1);
+  snap->strings = (const char *) (snap->records + header->count);
+  snap->size = st.st_size;
+  if (memcmp (header->magic, SNAPSHOT_MAGIC, sizeof SNAPSHOT_MAGIC)
+      || header->version != SNAPSHOT_VERSION
+      || header->record_size != sizeof *rec
+      || sizeof *header + (uint64_t) header->count * sizeof *rec
+	 + header->strings_size != (uint64_t) st.st_size
+      || !header->strings_size
+      || snap->strings[header->strings_size - 1])
+    goto bad;
+  /* with every offset checked once, lookups need no more checks */
+  size = header->strings_size;
+  for (i = 0, rec = snap->records; i < header->count; i++, rec++)
+    if (rec->comm >= size || rec->stat >= size || rec->exe >= size
+	|| rec->cmdline >= size || rec->cmdline_len >= size - rec->cmdline)
+      goto bad;
+  return snap;
+
+bad:
+  fprintf (stderr, _("%s: not a process snapshot\n"), path);
+  exit (1);
+}
+
+
+void
+snapshot_close (struct snapshot *snap)
+{
+  (void) munmap ((void *) snap->header, snap->size);
+  free (snap);
+}
+
+
+const struct snapshot_record *
+snapshot_find (const struct snapshot *snap, pid_t pid)
+{
+  const struct snapshot_record *rec;
+  uint32_t low = 0, high = snap->header->count;
+
+  while (low < high)
+    {
+      rec = &snap->records[low + (high - low) / 2];
+      if (rec->pid == pid)
+	return rec;
+      if (rec->pid < pid)
+	low = rec - snap->records + 1;
+      else
+	high = rec - snap->records;
+    }
+  return NULL;
+}
+
+
+const char *
+snapshot_string (const struct snapshot *snap, uint32_t offset)
+{
+  return snap->strings + offset;
+}
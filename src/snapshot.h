@@ -0,0 +1,74 @@
+/* snapshot.h - saved process table shared by pstree, pidof and prtstat */
+
+/* See file COPYING for copying conditions. */
+
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* A snapshot file is a header, count fixed-size records sorted by pid and
+   a string table, all in host byte order.  Strings are referred to by
+   their offset in the table and end in a NUL; offset 0 is the empty
+   string.  A record with tgid != pid is a thread, it has no stat, cmdline
+   or exe of its own and shares the comm of its process. */
+
+#define SNAPSHOT_MAGIC "PSMSNAP"
+#define SNAPSHOT_VERSION 1
+
+struct snapshot_header
+{
+  char magic[8];		/* SNAPSHOT_MAGIC */
+  uint32_t version;		/* SNAPSHOT_VERSION */
+  uint32_t record_size;		/* sizeof (struct snapshot_record) */
+  uint32_t count;		/* number of records */
+  uint32_t strings_size;	/* size of the string table */
+};
+
+struct snapshot_record
+{
+  int32_t pid;
+  int32_t tgid;
+  int32_t ppid;
+  int32_t pgrp;
+  uint32_t uid;			/* owner of /proc/PID */
+  uint32_t comm;
+  uint32_t stat;		/* contents of /proc/PID/stat */
+  uint32_t cmdline;		/* contents of /proc/PID/cmdline ... */
+  uint32_t cmdline_len;		/* ... which may hold NULs itself */
+  uint32_t exe;			/* target of /proc/PID/exe, if readable */
+  uint64_t exe_dev;
+  uint64_t exe_ino;
+};
+
+struct snapshot
+{
+  const struct snapshot_header *header;
+  const struct snapshot_record *records;
+  const char *strings;
+  size_t size;
+};
+
+void snapshot_save (const char *path);
+
+/* Reads every process and thread below /proc once and writes them to
+   PATH, replacing it atomically. On failure an error message is displayed
+   and the program is terminated. */
+
+struct snapshot *snapshot_open (const char *path);
+
+/* Maps the snapshot in PATH into memory and checks it. On failure an error
+   message is displayed and the program is terminated. */
+
+void snapshot_close (struct snapshot *snap);
+
+const struct snapshot_record *snapshot_find (const struct snapshot *snap,
+					     pid_t pid);
+
+/* Returns the record of PID, or NULL if it is not in the snapshot. */
+
+const char *snapshot_string (const struct snapshot *snap, uint32_t offset);
+
+#endif